@@ -18,588 +18,3535 @@
 // https://github.com/torvalds/linux/blob/master/tools/include/nolibc/nolibc.h
 #include "nolibc.h"
 
-// Just substitute it quickly
-void printf(char* string) {
-	write(1, string, strlen(string));
-}
+#include <stdarg.h>
 
 #define COLOR_YELLOW "\x1b[33m"
 #define COLOR_RESET "\x1b[0m"
 
-// Print a warning but don't stop
-void warn(char* message) {
-	printf(COLOR_YELLOW "[WARNING] ");
-	printf(message);
-	printf(COLOR_RESET);
-}
+// Syslog severities, as understood by /dev/kmsg
+#define LOG_ERR 3
+#define LOG_WARNING 4
+#define LOG_NOTICE 5
+#define LOG_INFO 6
 
-// Print a error and stop
-void err(char* message) {
-	printf(COLOR_YELLOW "[ERROR] ");
-	printf(message);
-	printf("Stopping...");
+// Format a message into buf, always terminated
+// Understands %s, %c, %d, %ld, %u, %x and %%
+int format(char* buf, int size, char* fmt, va_list args) {
+	int len = 0;
 
-	while (1) {
+	void put(const char* str) {
+		while (*str && len < size - 1)
+			buf[len++] = *str++;
 	}
-}
 
-// Write a string to file
-void echo(char* str, char* destination) {
-	int fd = open(destination, O_RDWR, 0);
+	for (; *fmt; fmt++) {
+		if (*fmt != '%') {
+			if (len < size - 1)
+				buf[len++] = *fmt;
 
-	if (fd < 0) {
-		printf(COLOR_YELLOW "[WARNING] Failed to open [");
-		printf(destination);
-		printf("]\n" COLOR_RESET);
+			continue;
+		}
 
-		return;
-	}
+		fmt++;
 
-	int rc = write(fd, str, strlen(str));
+		int is_long = *fmt == 'l';
+
+		if (is_long)
+			fmt++;
+
+		if (*fmt == 's') {
+			char* str = va_arg(args, char*);
+
+			put(str ? str : "(null)");
+		} else if (*fmt == 'c') {
+			char c[] = { va_arg(args, int), 0 };
 
-	if (rc < 0) {
-		printf(COLOR_YELLOW "[WARNING] Failed to write [");
-		printf(str);
-		printf("] to [");
-		printf(destination);
-		printf("]\n" COLOR_RESET);
+			put(c);
+		} else if (*fmt == 'd') {
+			put(ltoa(is_long ? va_arg(args, long) : va_arg(args, int)));
+		} else if (*fmt == 'u') {
+			put(ltoa(is_long ? va_arg(args, unsigned long) : va_arg(args, unsigned int)));
+		} else if (*fmt == 'x') {
+			unsigned long n = is_long ? va_arg(args, unsigned long) : va_arg(args, unsigned int);
+			char hex[2 * sizeof(long) + 1];
+			int pos = sizeof(hex) - 1;
+
+			hex[pos] = 0;
+
+			do {
+				hex[--pos] = "0123456789abcdef"[n & 15];
+				n >>= 4;
+			} while (n);
+
+			put(hex + pos);
+		} else if (*fmt == '%') {
+			put("%");
+		} else {
+			break;
+		}
 	}
 
-	close(fd);
+	buf[len] = 0;
+
+	return len;
 }
 
+// Same as format(), for building paths and such
+int sformat(char* buf, int size, char* fmt, ...) {
+	va_list args;
+
+	va_start(args, fmt);
+	int len = format(buf, size, fmt, args);
+	va_end(args);
+
+	return len;
+}
+
+// With `mi_kmsg=1` every message is also copied into the kernel log, so it shows up in `dmesg`
+// Opened once from main(): a vfork()ed child shares our memory, but not our fd table
+int kmsg_fd = -1;
 
-// Start the specified program and monitor it
-// If it exited without an error, restart
-// If it was killed, restart
-//
-// Do not keep restarting it if it keeps exiting with an error
-// It's unlikely it will suddenly start working
 //
-// Used for `wpa_supplicant` and `sshd`
+// Boot log
 //
-void keep_restarting(char* path, char* argv[], char* envp[]) {
-
-	// Version of warn() that takes two arguments
-	// Abusing the function scope
-	void warn(char* origin, char* message) {
-		printf(COLOR_YELLOW "[WARNING] [");
-		printf(origin);
-		printf("] ");
-		printf(message);
-		printf(COLOR_RESET);
-	}
 
-	int exitcode = 0;
+// Every message also lands in a ring buffer, so it can still be read after the console has scrolled away
+// Once /run is up, the ring is mirrored into /run/micro_init/log, so it can be fetched over ssh
+// The oldest lines are dropped when the ring wraps around
+#define LOG_RING_SIZE 16384
 
-	while (1) {
-		pid_t ws_pid = fork();
+char log_ring[LOG_RING_SIZE];
 
-		if (ws_pid < 0) {
-			warn(path, "Fork error\n");
-			return;
-		}
+// Total bytes ever written; the ring position is log_head % LOG_RING_SIZE
+// Only ever moves forward, and only after the bytes are in place, so a reader never sees a half written line
+// There is nothing to lock against: signals arrive through the signalfd rather than handlers,
+// and a vfork()ed child that logs does so while we are suspended
+unsigned long log_head = 0;
 
-		// Child: run wpa_supplicant
-		if (ws_pid == 0) {
-			int rc = execve(path, argv, envp);
+// Set once /run is mounted, until then /run/micro_init would end up on the boot medium
+int log_persist = 0;
 
-			if (rc) {
-				warn(path, "Execve error\n");
-				exit(-1);
-			}
+// New lines are appended to the file as they come in
+// Once another ring's worth has piled up, it is rewritten from the ring, so it stays between one and two rings long
+int log_fd = -1;
+unsigned long log_rewritten = 0;	// log_head as of the last rewrite
 
-			// Should never reach
-			err("Flow bugcheck\n");
-		}
+void log_ring_put(const char* str, int len) {
+	unsigned long head = log_head;
 
-		// Parent: wait for child to exit
-		int rc = waitpid(ws_pid, &exitcode, 0);
+	for (int i = 0; i < len; i++)
+		log_ring[(head + i) % LOG_RING_SIZE] = str[i];
 
-		if (rc < 0) {
-			warn(path, "Waitpid error\n");
-			return;
-		}
+	__atomic_store_n(&log_head, head + len, __ATOMIC_RELEASE);
+}
 
-		if WEXITSTATUS(exitcode) {
-			warn(path, "Exited with an error\n");
-			break;
-		}
+// Prefix a line with the time since boot in seconds, like dmesg does
+void log_ring_stamp() {
+	struct timespec ts;
+	char stamp[32] = "[";
+	char frac[] = ".000000] ";
+	long us = 0;
 
-		warn(path, "Was killed or exited without an error; restarting...\n");
-	}
+	clock_gettime(CLOCK_BOOTTIME, &ts);
 
-	exit(-1);
-}
+	us = ts.tv_nsec / 1000;
 
-void wait_for(char* path, char* argv[], char* envp[]) {
+	for (int i = 6; i > 0; i--, us /= 10)
+		frac[i] += us % 10;
 
-	// Version of warn() that takes two arguments
-	// Abusing the function scope
-	void warn(char* origin, char* message) {
-		printf(COLOR_YELLOW "[WARNING] [");
-		printf(origin);
-		printf("] ");
-		printf(message);
-		printf(COLOR_RESET);
-	}
+	strcpy(stamp + 1, ltoa(ts.tv_sec));
+	log_ring_put(stamp, strlen(stamp));
+	log_ring_put(frac, sizeof(frac) - 1);
+}
 
-	int exitcode = 0;
+// Write out the bytes of the ring from log_head values from to to
+// Must still be in the ring
+void log_ring_write(int fd, unsigned long from, unsigned long to) {
+	unsigned long start = from % LOG_RING_SIZE;
+	unsigned long len = to - from;
+	unsigned long first = LOG_RING_SIZE - start < len ? LOG_RING_SIZE - start : len;
 
-	pid_t pid = fork();
+	struct iovec iov[] = {
+		{ log_ring + start, first },
+		{ log_ring, len - first },
+	};
 
-	if (pid < 0) {
-		warn(path, "Fork error\n");
-		return;
-	}
+	writev(fd, iov, 2);
+}
 
-	// Child: run the command
-	if (pid == 0) {
-		int rc = execve(path, argv, envp);
+// Rewrite /run/micro_init/log from the ring, oldest line first
+void log_ring_flush() {
+	unsigned long head = __atomic_load_n(&log_head, __ATOMIC_ACQUIRE);
+	unsigned long tail = head > LOG_RING_SIZE ? head - LOG_RING_SIZE : 0;
 
-		if (rc) {
-			warn(path, "Execve error\n");
-			exit(-1);
+	// Skip the remains of a line that was partially overwritten
+	if (tail)
+		while (tail < head && log_ring[tail++ % LOG_RING_SIZE] != '\n') {
 		}
 
-		// Should never reach
-		err("Flow bugcheck\n");
-	}
+	if (log_fd >= 0)
+		close(log_fd);
 
-	// Parent: wait for child to exit
-	int rc = waitpid(pid, &exitcode, 0);
+	log_fd = open("/run/micro_init/log", O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+	log_rewritten = head;
 
-	if (rc < 0) {
-		warn(path, "Waitpid error\n");
-		return;
-	}
+	if (log_fd >= 0)
+		log_ring_write(log_fd, tail, head);
+}
 
-	if WEXITSTATUS(exitcode)
-		warn(path, "Exited with an error\n");
+// Called once /run is mounted
+void log_ring_persist() {
+	mkdir("/run/micro_init", 0755);
+
+	log_persist = 1;
+	log_ring_flush();
 }
 
+// Every message leaves in a single writev(), so it can't get torn apart by output from the children
+void log_message(int level, char* fmt, va_list args) {
+	static char buf[1024];
 
-//
-// Disk image mounts
-//
+	int len = format(buf, sizeof(buf), fmt, args);
 
-// Hostile environment, no easy way to build strings
-// Just keep a bunch of prebuilt ones
-char* lut[] = { "/dev/loop0",
-		"/dev/loop1",
-		"/dev/loop2",
-		"/dev/loop3",
-		"/dev/loop4",
-		"/dev/loop5",
-		"/dev/loop6",
-		"/dev/loop7",
-		"/dev/loop8",
-		"/dev/loop9",
-		"/dev/loop10",
-		"/dev/loop11",
-		"/dev/loop12",
-		"/dev/loop13",
-		"/dev/loop14",
-		"/dev/loop15" };
+	char* prefix = "";
+	char* suffix = "";
 
-// include/uapi/linux/loop.h
-#define LOOP_CTL_GET_FREE 0x4C82
-#define LOOP_SET_FD 0x4C00
-#define LOOP_CLR_FD 0x4C01
+	if (level == LOG_ERR)
+		prefix = COLOR_YELLOW "[ERROR] ";
 
-// include/uapi/linux/mount.h
-#define MS_RDONLY 1
-#define MS_BIND 4096
+	if (level == LOG_WARNING)
+		prefix = COLOR_YELLOW "[WARNING] ";
 
-#define IMAGE_PATH "/ext2.img"
-#define IMAGE_FS_TYPE "ext2"
-#define TARGET_DIRECTORY "/newroot"
+	if (level == LOG_NOTICE)
+		prefix = COLOR_YELLOW;
 
-// Create a loop device and mount the rootfs image
-void mount_ext2_image() {
-	int ctl_fd = open("/dev/loop-control", O_RDWR, 0);
+	if (level <= LOG_NOTICE)
+		suffix = COLOR_RESET;
 
-	if (ctl_fd < 0)
-		err(	"Failed to open /dev/loop-control;\n"
-			"1. Is folder `dev` missing on real root and devtmpfs didn't initialize?\n"
-			"2. Is loop device support compiled in?\n"					);
+	struct iovec iov[] = {
+		{ prefix, strlen(prefix) },
+		{ buf, len },
+		{ suffix, strlen(suffix) },
+	};
 
-	int loop_num = ioctl(ctl_fd, LOOP_CTL_GET_FREE, NULL);
-	if (loop_num < 0) err(	"Request to spawn a new loop device was denied\n"
-				"Is folder `dev` missing on real root and devtmpfs didn't initialize?\n" );
+	writev(1, iov, 3);
 
-	char* loop_path = lut[loop_num];
-	int loop_fd = open(loop_path, O_RDWR, 0);
-	if (loop_fd < 0) err("Failed to open the dispensed loop???\n");
+	static char* levels[] = { [LOG_ERR] = "[ERROR] ", [LOG_WARNING] = "[WARNING] ", [LOG_NOTICE] = "", [LOG_INFO] = "" };
 
-	int image_fd = open(IMAGE_PATH, O_RDWR, 0);
-	if (image_fd < 0) err("Failed to open [" IMAGE_PATH "]!\n" );
+	unsigned long line = log_head;
 
-	ioctl(loop_fd, LOOP_SET_FD, image_fd);
+	log_ring_stamp();
+	log_ring_put(levels[level], strlen(levels[level]));
+	log_ring_put(buf, len);
 
-	int rc = mount(loop_path, TARGET_DIRECTORY, IMAGE_FS_TYPE, MS_RDONLY, NULL);
+	// Never from a child between spawn() and execve(): log_fd is shared with init, the fd table is not
+	// The next message from init does the rewrite instead
+	if (log_persist && log_head - log_rewritten > LOG_RING_SIZE && getpid() == 1)
+		log_ring_flush();
+	else if (log_fd >= 0)
+		log_ring_write(log_fd, line, log_head);
 
-	if (rc) err("Failed to mount the loop into [" TARGET_DIRECTORY "]!\n");
-}
+	if (kmsg_fd < 0)
+		return;
 
+	// One write is one record, the level goes in front: `<4>micro_init: ...`
+	char tag[] = "<0>micro_init: ";
 
-//
-// Sysfs mounts
-//
+	tag[1] += level;
+
+	iov[0] = (struct iovec){ tag, sizeof(tag) - 1 };
 
-// Bind folder A to folder B
-int mount_bind(char* source, char* destination) {
-	return mount(source, destination, NULL, MS_BIND, NULL);
+	writev(kmsg_fd, iov, 2);
 }
 
-// Will make the following binds:
-// /dev -> /newroot/dev
-// See Void Linux init scripts to get an insight into starting a Linux system:
-// https://github.com/void-linux/void-runit/tree/master/core-services
-void bind_dev() {
-	int rc = 0;
+// Substitute it with something that formats
+void printf(char* fmt, ...) {
+	va_list args;
 
-	rc = mount_bind("/dev", TARGET_DIRECTORY "/dev");
-	if (rc) err(	"Error binding [/dev] to [" TARGET_DIRECTORY "/dev]\n"
-			"Perhaps /dev is missing in the rootfs you're using?\n" );
+	va_start(args, fmt);
+	log_message(LOG_INFO, fmt, args);
+	va_end(args);
 }
 
-// Will make fresh mounts of:
-// /dev/shm 			Ramdisk
-// /dev/pts 			Pseudoterminals
-void mount_shm_pts() {
-	int rc = 0;
-
-	rc = mkdir("/dev/shm", 0777);
-	if (rc) err("Failed to create [/dev/shm]\n");
+// Print something the user should read, highlighted
+void notice(char* fmt, ...) {
+	va_list args;
 
-	rc = mount("shm", "/dev/shm", "tmpfs", 0, NULL);
-	if (rc) err("Error mounting [/dev/shm]\n");
+	va_start(args, fmt);
+	log_message(LOG_NOTICE, fmt, args);
+	va_end(args);
+}
 
-	rc = mkdir("/dev/pts", 0755);
-	if (rc) err("Failed to create [/dev/pts]\n");
+// Print a warning but don't stop
+// For failures that leave the system degraded but usable, i.e. a missing mount
+void warn(char* fmt, ...) {
+	va_list args;
 
-	rc = mount("devpts", "/dev/pts", "devpts", 0, NULL);
-	if (rc) err("Error mounting [/dev/pts]\n");
+	va_start(args, fmt);
+	log_message(LOG_WARNING, fmt, args);
+	va_end(args);
 }
 
-// Will make a fresh mount of /proc
-// Task managers (And a ton of other stuff) will not work without this mounted
-void mount_procfs() {
-	int rc = mount("proc", "/proc", "proc", 0, NULL);
-	if (rc) err(	"Error mounting procfs into [/proc]\n"
-			"Perhaps /proc is missing in the rootfs you're using?\n"  );
+void emergency() __attribute__((noreturn));
+void shut_down(int cmd);
+
+// Print a error and stop
+// For failures that leave nothing to boot into, see emergency() for what happens next
+void err(char* fmt, ...) {
+	va_list args;
+
+	va_start(args, fmt);
+	log_message(LOG_ERR, fmt, args);
+	va_end(args);
+
+	emergency();
 }
 
-// Will make a fresh mount of /sys
-// `lsblk` and `df` (And a ton of other stuff) will not work without this mounted
-void mount_sysfs() {
-	int rc = mount("sysfs", "/sys", "sysfs", 0, NULL);
-	if (rc) err(    "Error mounting sysfs into [/sys]\n"
-			"Perhaps /sys is missing in the rootfs you're using?\n"  );
+// Write a string to file
+// Returns 0 on success
+int echo(char* str, char* destination) {
+	int fd = open(destination, O_RDWR, 0);
+
+	if (fd < 0) {
+		warn("Failed to open [%s]\n", destination);
+		return -1;
+	}
+
+	int rc = write(fd, str, strlen(str));
+
+	if (rc < 0)
+		warn("Failed to write [%s] to [%s]\n", str, destination);
+
+	close(fd);
+
+	return rc < 0 ? -1 : 0;
 }
 
-// Will make a fresh mount of /run
-// Repicates the mount structure WSL1 uses
-// `sshd` and `watchdog` want it to store temporary files
-void mount_run() {
-	int rc = 0;
+// Read up to size - 1 bytes of a file into buf and terminate it
+// Returns the length or -1 on failure
+int read_file(char* path, char* buf, int size) {
+	int fd = open(path, O_RDONLY | O_CLOEXEC, 0);
 
-	rc = mount("tmpfs", "/run", "tmpfs", 0, NULL);
-	if (rc) err("Error mounting [/run]\n"
-				"Perhaps /run is missing in the rootfs you're using?");
+	if (fd < 0)
+		return -1;
 
-	// /run/lock rwxrwxrwx
-	rc = mkdir("/run/lock", 0777);
-	if (rc) err("Failed to create [/run/lock]\n");
+	int len = 0;
 
-	rc = mount("tmpfs", "/run/lock", "tmpfs", 0, NULL);
-	if (rc) err("Error mounting [/run/lock]\n");
+	while (len < size - 1) {
+		int rc = read(fd, buf + len, size - 1 - len);
 
-	// /run/shm rwxrwxrwx
-	rc = mkdir("/run/shm", 0777);
-	if (rc) err("Failed to create [/run/shm]\n");
+		if (rc <= 0)
+			break;
+
+		len += rc;
+	}
 
-	rc = mount("shm", "/run/shm", "tmpfs", 0, NULL);
-	if (rc) err("Error mounting [/run/shm]\n");
+	close(fd);
 
-	// /run/user rwxr-xr-x
-	rc = mkdir("/run/user", 0755);
-	if (rc) err("Failed to create [/run/user]\n");
+	buf[len] = 0;
 
-	rc = mount("tmpfs", "/run/user", "tmpfs", 0, NULL);
-	if (rc) err("Error mounting [/run/user]\n");
+	return len;
 }
 
-// Will make a fresh mount of /var/log
-// Log to RAM, no way to persist logs on read-only system
-// Required by `watchdog` and used by `apt`
-void mount_var_log() {
-	int rc = 0;
+// Milliseconds since boot, never jumps
+int64_t now_ms() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
 
-	rc = mount("tmpfs", "/var/log", "tmpfs", 0, NULL);
-	if (rc) err("Error mounting [/var/log]\n"
-				"Perhaps /var/log is missing in the rootfs you're using?");
+	return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
 }
 
+// The kernel passes `name=value` arguments it doesn't recognize to init as environment variables
+// That makes them usable as boot options, i.e. `mi_backoff_max=60000`
+// (Names with a dot in them are taken for module parameters and never reach init)
+char** boot_env = NULL;
 
-//
-// Symlinks
-//
+char* boot_option(char* name) {
+	int len = strlen(name);
 
-// Make /dev/fd point to /proc/self/fd
-// This is required for process substitution to work, i.e. bash <(echo 123)
-// Also used by certain programs like wg-quick
-void symlink_dev_fd() {
-	int rc = symlink("/proc/self/fd", "/dev/fd");
+	for (int i = 0; boot_env && boot_env[i]; i++)
+		if (!memcmp(boot_env[i], name, len) && boot_env[i][len] == '=')
+			return boot_env[i] + len + 1;
 
-	if (rc) err("Error symlinking [/dev/fd] -> [/proc/self/fd]\n");
+	return NULL;
 }
 
+int boot_option_int(char* name, int fallback) {
+	char* value = boot_option(name);
 
-//
-// Chroot
-//
-
-// Executables have a hardcoded list of paths with the .so files they need
-// Without chrooting kernel's ELF loader will be unable to find them
-void set_root() {
-	chroot("/newroot");
-	chdir("/");
+	return value ? atoi(value) : fallback;
 }
 
+// include/uapi/linux/auxvec.h
+#define AT_PAGESZ 6
+
+// Taken from the auxiliary vector in main()
+long page_size = 4096;
+
 
 //
-// Root shell, the first thing that greets you
+// Boot timeline
 //
 
-// Ubuntu Base does not have any init system as it turns out
-// Just launch bash then
-// (Using `su -`)
+// Every boot stage and every process started during boot gets a start and an end timestamp
+// Once the shell is up, the table is written to /run/micro_init/boot-timeline:
 //
-// "can't access tty; job control turned off" workarounds:
-// https://www.linux.org.ru/forum/general/6211553
-// Adding --pty fixed it
-void exec_shell() {
-	char* argv[] = { "su", "-", "--pty", NULL };
-	char* envp[] = { "HOME=/", "TERM=linux", NULL };
+// start_ms	end_ms	duration_ms	name
+// 1021.337	1021.405	0.068	procfs
+//
+// Times are CLOCK_BOOTTIME, so they include the time the kernel took to get to init
+// An end of `-` means it was still running at the time of the dump
+// With `mi_timeline=1` the table is also printed to the console
+#define TIMELINE_SIZE 64
 
-	printf(COLOR_YELLOW "Dropping you into a root shell so you can set a password or create a new account. If done, use Ctrl + Alt + F2 to F12 to switch into a real console.\n" COLOR_RESET);
+struct timeline_event {
+	char* name;
+	int64_t start;		// Microseconds
+	int64_t end;		// 0 if still running
+};
 
-	int rc = execve("/bin/su", argv, envp);
+struct timeline_event timeline[TIMELINE_SIZE];
+int timeline_count = 0;
+int timeline_closed = 0;	// Nothing gets recorded after the dump
 
-	if (rc)
-		err("exec_shell: failed to start shell\n");
+int64_t boottime_us() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_BOOTTIME, &ts);
+
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
 }
 
+// Returns a handle for timeline_end(), or -1 if the event wasn't recorded
+int timeline_begin(char* name) {
+	if (timeline_closed || timeline_count == TIMELINE_SIZE)
+		return -1;
 
-//
-// Loopback
-//
+	timeline[timeline_count] = (struct timeline_event){ name, boottime_us(), 0 };
 
-// This is required for nginx or other TCP servers to be reachable via 127.0.0.1
-// Sanity check: `ssh 127.0.0.1` should work
-void activate_loopback() {
-	char* argv[] = { "ip", "link", "set", "up", "dev", "lo", NULL };
-	char* envp[] = { "HOME=/", "TERM=linux", NULL };
+	return timeline_count++;
+}
+
+void timeline_end(int event) {
+	if (event < 0 || timeline_closed)
+		return;
 
-	wait_for("/bin/ip", argv, envp);
+	timeline[event].end = boottime_us();
 }
 
+void write_timeline() {
+	static char buf[TIMELINE_SIZE * 64];
+	int len = 0;
 
-//
-// Set hostname
-//
+	void put(const char* str) {
+		while (*str && len < sizeof(buf))
+			buf[len++] = *str++;
+	}
 
-// `sudo` is unhappy without a valid hostname set
-// Sanity check: `ssh localhost` should work
-void exec_hostname() {
-	char* argv[] = { "hostname", "-F", "/etc/hostname", NULL };
-	char* envp[] = { "HOME=/", "TERM=linux", NULL };
+	// Milliseconds with three decimals
+	void put_us(int64_t us) {
+		char frac[] = ".000";
 
-	wait_for("/bin/hostname", argv, envp);
-}
+		frac[1] += us / 100 % 10;
+		frac[2] += us / 10 % 10;
+		frac[3] += us % 10;
 
+		put(ltoa(us / 1000));
+		put(frac);
+	}
 
-//
-// Sysctl
-//
+	timeline_closed = 1;
 
-// Usually this is done using `sysctl`
-// But we can avoid using it, saving us a fork()
-void apply_sysctl() {
-	//echo("ondemand", "/sys/devices/system/cpu/cpufreq/policy0/scaling_governor");	// We may have booted with `performance` or `powersave`
-	//echo("bbr", "/proc/sys/net/ipv4/tcp_congestion_control"); 			// Switch to a better congestion control algorithm
-	echo("1", "/proc/sys/net/ipv4/ip_forward");					// Allow packets to jump between interfaces
+	put("start_ms\tend_ms\tduration_ms\tname\n");
+
+	for (int i = 0; i < timeline_count; i++) {
+		struct timeline_event* event = &timeline[i];
+
+		put_us(event->start);
+		put("\t");
+
+		if (event->end) {
+			put_us(event->end);
+			put("\t");
+			put_us(event->end - event->start);
+		} else {
+			put("-\t-");
+		}
+
+		put("\t");
+		put(event->name);
+		put("\n");
+	}
+
+	if (boot_option_int("mi_timeline", 0))
+		write(1, buf, len);
+
+	// Nowhere to put it without /run
+	if (!log_persist)
+		return;
+
+	int fd = open("/run/micro_init/boot-timeline", O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+	if (fd < 0) {
+		warn("Failed to write [/run/micro_init/boot-timeline]\n");
+		return;
+	}
+
+	write(fd, buf, len);
+	close(fd);
 }
 
 
+// Everything that happens between the clone and execve()
+// Lives in a function of its own because the child is running on the stack of spawn()
+__attribute__((noinline, noreturn))
+void spawn_child(char* path, char* argv[], char* envp[], int flags);
+
+#define SPAWN_SETSID 1		// Give it a session of its own, like `agetty` wants
+#define SPAWN_NULL_STDIN 2	// Don't let it read from the console
+
+// Where a child whose execve() failed leaves the errno, init sees it because the two share memory
+// CLONE_VFORK keeps init asleep until the child has either exec'd or exited, so it is settled by the time spawn() looks
+volatile int spawn_errno;
+
+// Start the specified program without waiting for it
+// Returns the pid of the new process or -1 on failure, which includes execve() failing in the child
+// If pidfd is not NULL, it receives a file descriptor that refers to the new process (or -1)
 //
-// Ctrl + Alt + F2 to F12 terminals
-//
+// The child borrows init's memory until execve() (CLONE_VM | CLONE_VFORK)
+// No page tables get copied and no copy-on-write faults follow; init just sleeps for the few microseconds in between
+pid_t spawn(char* path, char* argv[], char* envp[], int flags, int* pidfd) {
+	pid_t pid = -ENOSYS;
 
-void exec_agetty(char* tty) {
-	pid_t agetty_pid = fork();
+	if (pidfd)
+		*pidfd = -1;
 
-	if (agetty_pid < 0)
-		err("exec_agetty: fork error\n");
+	spawn_errno = 0;
 
-	// Always restart agetty
-	if (agetty_pid > 0) {
-		waitpid(agetty_pid, NULL, 0);
-		exec_agetty(tty);
-	};
+#ifdef __NR_clone3
+	struct clone_args args = { 0 };
 
-	setsid();
+	args.flags = CLONE_VM | CLONE_VFORK;
+	args.exit_signal = SIGCHLD;
 
-	char* argv[] = { "agetty", "", NULL };
-	char* envp[] = { "HOME=/", "TERM=linux", NULL };
+	if (pidfd) {
+		args.flags |= CLONE_PIDFD;
+		args.pidfd = (uintptr_t)pidfd;
+	}
 
-	argv[1] = tty;
+	pid = sys_clone3(&args, sizeof(args));
+#endif
 
-	int rc = execve("/sbin/agetty", argv, envp);
+	// Kernels before 5.3 don't have clone3(), go without the pidfd there
+	if (pid == -ENOSYS)
+		pid = sys_vfork();
 
-	if (rc)
-		err("exec_agetty: execve error\n");
+	if (pid == 0)
+		spawn_child(path, argv, envp, flags);
+
+	if (pid < 0) {
+		warn("[%s] Clone error\n", path);
+
+		return -1;
+	}
+
+	// It has already exited, so this doesn't block
+	if (spawn_errno) {
+		waitpid(pid, NULL, 0);
+
+		if (pidfd && *pidfd >= 0) {
+			close(*pidfd);
+			*pidfd = -1;
+		}
+
+		return -1;
+	}
+
+	return pid;
 }
 
-void start_every_tty() {
-	char* ttys[] = { "tty2", "tty3", "tty4", "tty5", "tty6", "tty7", "tty8", "tty9", "tty10", "tty11", "tty12", NULL };
-	int i = 0;
+void spawn_child(char* path, char* argv[], char* envp[], int flags) {
+	// Init keeps SIGCHLD blocked, don't pass that on
+	ksigset_t empty;
 
-	while (ttys[i]) {
-		pid_t pid = fork();
+	sigemptyset(&empty);
+	sigprocmask(SIG_SETMASK, &empty, NULL);
 
-		if (pid < 0)
-			err("start_every_tty: fork error\n");
+	if (flags & SPAWN_SETSID)
+		setsid();
 
-		if (pid == 0)
-			exec_agetty(ttys[i]);
+	// Everything else init opens is O_CLOEXEC, so only 0, 1 and 2 get inherited
+	if (flags & SPAWN_NULL_STDIN) {
+		int fd = open("/dev/null", O_RDONLY, 0);
 
-		i++;
+		if (fd > 0) {
+			dup2(fd, 0);
+			close(fd);
+		}
 	}
+
+	execve(path, argv, envp);
+
+	spawn_errno = errno;
+
+	warn("[%s] Execve error\n", path);
+
+	exit(-1);
 }
 
 
 //
-// SSH server
+// Supervisor
 //
 
-void exec_ssh_keygen() {
-	char* argv[] = { "ssh-keygen", "-A", NULL };
-	char* envp[] = { "HOME=/", "TERM=linux", NULL };
+// PID 1 watches all of its children from a single loop
+// SIGCHLD stays blocked and is picked up from a signalfd, so there is no signal handler to race with
+// The same goes for the signals that ask for a shutdown
+int signal_fd = -1;
 
-	wait_for("/bin/ssh-keygen", argv, envp);
-}
+void watch_children() {
+	ksigset_t mask;
 
-void start_ssh() {
-	char* argv[] = { "/sbin/sshd", "-D", NULL };
-	char* envp[] = { "HOME=/", "TERM=linux", NULL };
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGCHLD);
+	sigaddset(&mask, SIGTERM);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGUSR1);
+	sigaddset(&mask, SIGUSR2);
 
-	// The "privilege separation directory"
-	int rc = mkdir("/run/sshd", 0755);
+	int rc = sigprocmask(SIG_BLOCK, &mask, NULL);
+	if (rc) err("Failed to block signals\n");
 
-	if (rc)
-		warn("Failed to create [/run/sshd]\n");
+	signal_fd = signalfd(-1, &mask, O_NONBLOCK | O_CLOEXEC);
+	if (signal_fd < 0) err("Failed to create a signalfd\n");
 
-	// Ensure we have host keys
-	exec_ssh_keygen();
+	// Ctrl + Alt + Del sends SIGINT instead of resetting the machine on the spot
+	reboot(LINUX_REBOOT_CMD_CAD_OFF);
+}
 
-	pid_t pid = fork();
+// Same signals as busybox init:
+// SIGTERM reboots, SIGUSR2 powers off, SIGUSR1 halts, SIGINT (Ctrl + Alt + Del) reboots
+// The main loop notices and goes through the shutdown sequence
+int shutdown_cmd = 0;
 
-	if (pid < 0)
-		warn("start_ssh: fork error\n");
+void shutdown_requested(int signal) {
+	if (signal == SIGTERM || signal == SIGINT)
+		shutdown_cmd = LINUX_REBOOT_CMD_RESTART;
 
-	if (pid == 0)
-		keep_restarting("/sbin/sshd", argv, envp);
+	if (signal == SIGUSR2)
+		shutdown_cmd = LINUX_REBOOT_CMD_POWER_OFF;
+
+	if (signal == SIGUSR1)
+		shutdown_cmd = LINUX_REBOOT_CMD_HALT;
 }
 
+#define RESTART_NEVER 0		// Leave it be once it exits
+#define RESTART_ON_SUCCESS 1	// Restart if it was killed or exited without an error
+#define RESTART_ALWAYS 2	// Restart no matter what
+#define RESTART_SESSION 3	// Restart right away after a clean exit (a logout), back off after a crash
+
+#define MAX_SERVICES 16
+#define MAX_ARGS 8
+
+// A service that keeps dying right after start is restarted with a growing delay:
+// 0, 100 ms, 200 ms, 400 ms... up to the ceiling
+// Staying up for RESTART_STABLE_MS resets the delay
+// More than RESTART_BURST restarts within RESTART_WINDOW_MS marks the service as failed
+// The ceiling and the burst window can be changed with `mi_backoff_max=`, `mi_restart_burst=` and `mi_restart_window=`
+#define RESTART_BACKOFF_MIN_MS 100
+#define RESTART_BACKOFF_MAX_MS 30000
+#define RESTART_STABLE_MS 10000
+#define RESTART_BURST 10
+#define RESTART_WINDOW_MS 60000
+
+// How long a process gets to exit after SIGTERM before it gets SIGKILL, in milliseconds
+// Both for stopping a single service and for the shutdown
+// Change with `mi_shutdown_timeout=`
+#define SHUTDOWN_TIMEOUT_MS 500
+
+// A session shorter than this is treated as a crash, it can't have been a real login
+#define RESTART_SESSION_MIN_MS 1000
+
+#define SERVICE_STOPPED 0	// Exited and won't be restarted
+#define SERVICE_RUNNING 1
+#define SERVICE_WAITING 2	// Restart is scheduled
+#define SERVICE_FAILED 3	// Gave up restarting
+#define SERVICE_IDLE 4		// Registered, but nobody asked for it yet
+
+char* service_states[] = { "stopped", "running", "waiting", "failed", "idle" };
+
+// Asked for over the control socket, done instead of the restart policy once the process exits
+#define STOP_REQUESTED 1
+#define RESTART_REQUESTED 2
+
+struct service {
+	char* name;
+	char* path;
+	char* argv[MAX_ARGS];
+	int policy;
+	int flags;		// SPAWN_* flags
+	pid_t pid;		// 0 if not running
+	int pidfd;		// Refers to the running process, -1 if none
+	int event;		// Boot timeline entry of the current run, -1 if none
+	int state;
+	int restarts;		// Total, for the status file
+	int backoff;		// Delay before the next restart, ms
+	int64_t started_at;
+	int64_t restart_at;
+	int64_t kill_at;	// SIGKILL if it is still running by then, 0 if not being stopped
+	int64_t window_start;	// Restarts are counted per window
+	int window_restarts;
+	int requested;		// STOP_REQUESTED, RESTART_REQUESTED or 0
+};
+
+struct service services[MAX_SERVICES];
+int service_count = 0;
+
+int backoff_max = RESTART_BACKOFF_MAX_MS;
+int restart_burst = RESTART_BURST;
+int restart_window = RESTART_WINDOW_MS;
+int stop_timeout = SHUTDOWN_TIMEOUT_MS;
+
+void read_restart_options() {
+	backoff_max = boot_option_int("mi_backoff_max", RESTART_BACKOFF_MAX_MS);
+	restart_burst = boot_option_int("mi_restart_burst", RESTART_BURST);
+	restart_window = boot_option_int("mi_restart_window", RESTART_WINDOW_MS);
+	stop_timeout = boot_option_int("mi_shutdown_timeout", SHUTDOWN_TIMEOUT_MS);
+}
 
-//
-// Shutdown sequence
-//
+// Services outlive the functions that register them, so they can't use a local envp
+char* service_envp[] = { "HOME=/", "TERM=linux", NULL };
 
-void terminate_processes() {
-	printf("Terminating processes...\n");
+// Register a program to be supervised
+// argv is copied, so it may live on the caller's stack
+struct service* add_service(char* name, char* path, char* argv[], int policy, int flags) {
+	if (service_count == MAX_SERVICES)
+		err("add_service: too many services\n");
 
-	kill(-1, 9);
+	struct service* service = &services[service_count++];
 
-	while (wait(0) > 0) {
-		// ...
-	}
+	service->name = name;
+	service->path = path;
+	service->policy = policy;
+	service->flags = flags;
+	service->pidfd = -1;
+	service->event = -1;
+
+	for (int i = 0; i < MAX_ARGS - 1 && argv[i]; i++)
+		service->argv[i] = argv[i];
+
+	return service;
 }
 
-#define MNT_DETACH 2
+// Dump the state of every service into /run/micro_init/services
+// One line per service: name, pid, state, restarts, current backoff in ms
+// i.e. `cat /run/micro_init/services` to spot a crash loop
+void write_service_status() {
+	static char buf[MAX_SERVICES * 64];
+	int len = 0;
+
+	void put(const char* str) {
+		while (*str && len < sizeof(buf))
+			buf[len++] = *str++;
+	}
 
-// For clean shutdowns
-void unmount_root() {
-	printf("Unmounting root...\n");
+	for (int i = 0; i < service_count; i++) {
+		struct service* service = &services[i];
+
+		put(service->name);
+		put(" ");
+		put(ltoa(service->pid));
+		put(" ");
+		put(service_states[service->state]);
+		put(" ");
+		put(ltoa(service->restarts));
+		put(" ");
+		put(ltoa(service->backoff));
+		put("\n");
+	}
 
-	int rc = umount2("/", 0);
+	// Silently skipped until /run is mounted
+	if (!log_persist)
+		return;
 
-	if (rc)
-		err("unmount_root: failed to unmount\n");
+	int fd = open("/run/micro_init/services", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+	if (fd < 0)
+		return;
+
+	write(fd, buf, len);
+	close(fd);
 }
 
+void start_service(struct service* service) {
+	pid_t pid = spawn(service->path, service->argv, service_envp, service->flags, &service->pidfd);
 
-//
-// Startup sequence
-//
+	service->pid = pid > 0 ? pid : 0;
+	service->state = pid > 0 ? SERVICE_RUNNING : SERVICE_STOPPED;
+	service->started_at = now_ms();
+	service->event = pid > 0 ? timeline_begin(service->name) : -1;
 
-int main() {
-	printf("= = = Micro Init = = =\n");
+	write_service_status();
+}
 
-	// If you call set_root() from PID 2 after the fork():
-	// PID 1 will stay at true root, thus allowing you to escape the chroot via `cd /proc/1/root`
-	// This is useful to inspect the real root
-	//mount_ext2_image();
-	//bind_dev();
-	//set_root();
-
-	// Fork into two separate processes
-	// Parent will receive shell_pid = child pid
-	// Child will receive shell_pid = 0
-	pid_t shell_pid = fork();
-
-	// If we are the child, start the shell
-	if (shell_pid == 0) {
-		// Critical mounts
-		mount_shm_pts();
-		mount_procfs();
-		mount_sysfs();
-		mount_run();
-		mount_var_log();
-
-		// Symlinks
-		symlink_dev_fd();
-
-		// Oneshot operations
-		activate_loopback();
-		exec_hostname();
-		apply_sysctl();
-
-		// Start restart-capable stuff
-		start_every_tty();
-		start_ssh();
-
-		// Transfer over to bash
-		exec_shell();
-
-		// Function above should never return
-		// But let's just make sure that we can't continue from this location
-		return 0;
+// Schedule a restart, or give up if it has been dying too often
+void restart_service(struct service* service) {
+	int64_t now = now_ms();
+
+	// A run that lasted long enough means the last crash was a one-off
+	if (now - service->started_at >= RESTART_STABLE_MS) {
+		service->backoff = 0;
 	} else {
-		while (shell_pid != wait(NULL)) {
-		}
+		service->backoff = service->backoff ? service->backoff * 2 : RESTART_BACKOFF_MIN_MS;
 
-		printf("Initial shell exited, entering shutdown sequence\n");
+		if (service->backoff > backoff_max)
+			service->backoff = backoff_max;
+	}
 
-		terminate_processes();
-		unmount_root();
+	if (now - service->window_start >= restart_window) {
+		service->window_start = now;
+		service->window_restarts = 0;
+	}
 
-		reboot(LINUX_REBOOT_CMD_RESTART);
+	if (++service->window_restarts > restart_burst) {
+		warn("[%s] Restarting too often; marked as failed\n", service->name);
+		service->state = SERVICE_FAILED;
+		write_service_status();
+		return;
+	}
+
+	service->restarts++;
+
+	if (service->backoff == 0) {
+		start_service(service);
+		return;
+	}
+
+	service->state = SERVICE_WAITING;
+	service->restart_at = now + service->backoff;
+	write_service_status();
+}
+
+// Start whatever is due, returns how long until the next one (-1 if nothing is scheduled)
+int start_waiting_services() {
+	int64_t now = now_ms();
+	int64_t next = -1;
+
+	for (int i = 0; i < service_count; i++) {
+		struct service* service = &services[i];
+
+		if (service->state != SERVICE_WAITING)
+			continue;
+
+		if (service->restart_at <= now) {
+			start_service(service);
+			continue;
+		}
+
+		if (next < 0 || service->restart_at - now < next)
+			next = service->restart_at - now;
+	}
+
+	return next;
+}
+
+// SIGKILL the services that were asked to stop and ignored the SIGTERM for too long
+// Returns how long until the next one is due (-1 if none)
+int kill_stuck_services() {
+	int64_t now = now_ms();
+	int64_t next = -1;
+
+	for (int i = 0; i < service_count; i++) {
+		struct service* service = &services[i];
+
+		if (!service->pid || !service->kill_at)
+			continue;
+
+		if (service->kill_at <= now) {
+			warn("[%s] Ignored SIGTERM; killing it\n", service->name);
+			kill(service->pid, SIGKILL);
+			service->kill_at = 0;
+			continue;
+		}
+
+		if (next < 0 || service->kill_at - now < next)
+			next = service->kill_at - now;
+	}
+
+	return next;
+}
+
+// Decide what to do with a service that has exited
+// Returns 0 if the pid doesn't belong to any service
+int service_exited(pid_t pid, int exitcode) {
+	for (int i = 0; i < service_count; i++) {
+		struct service* service = &services[i];
+
+		if (service->pid != pid)
+			continue;
+
+		service->pid = 0;
+		service->state = SERVICE_STOPPED;
+		service->kill_at = 0;
+
+		if (service->pidfd >= 0) {
+			close(service->pidfd);
+			service->pidfd = -1;
+		}
+
+		timeline_end(service->event);
+		service->event = -1;
+
+		if (service->policy == RESTART_NEVER || service->requested == STOP_REQUESTED) {
+			service->requested = 0;
+			write_service_status();
+			return 1;
+		}
+
+		if (service->requested == RESTART_REQUESTED) {
+			service->requested = 0;
+			service->backoff = 0;
+			service->restarts++;
+			start_service(service);
+			return 1;
+		}
+
+		// Logging out is what a getty is for, it doesn't count as a crash
+		// Unless it happens right after the start, which is a getty that can't open its tty
+		if (service->policy == RESTART_SESSION && WIFEXITED(exitcode) && !WEXITSTATUS(exitcode) &&
+		    now_ms() - service->started_at >= RESTART_SESSION_MIN_MS) {
+			service->backoff = 0;
+			service->window_restarts = 0;
+			service->restarts++;
+			start_service(service);
+			return 1;
+		}
+
+		if (service->policy == RESTART_ON_SUCCESS) {
+			// It's unlikely it will suddenly start working
+			if WEXITSTATUS(exitcode) {
+				warn("[%s] Exited with an error\n", service->name);
+				write_service_status();
+				return 1;
+			}
+
+			warn("[%s] Was killed or exited without an error; restarting...\n", service->name);
+		}
+
+		restart_service(service);
+
+		return 1;
+	}
+
+	return 0;
+}
+
+int unit_exited(pid_t pid, int exitcode);
+
+// Pass every exited child to whoever started it
+// Anything unclaimed is an orphan that got reparented to init
+void reap_children() {
+	int exitcode = 0;
+	pid_t pid;
+
+	while ((pid = waitpid(-1, &exitcode, WNOHANG)) > 0) {
+		if (unit_exited(pid, exitcode))
+			continue;
+
+		service_exited(pid, exitcode);
+	}
+}
+
+// Other file descriptors the loop should wake up for
+#define MAX_WATCHES 4
+
+struct watch {
+	int fd;
+	short events;
+	void (*ready)();
+};
+
+struct watch watches[MAX_WATCHES];
+int watch_count = 0;
+
+void watch_fd(int fd, short events, void (*ready)()) {
+	if (watch_count == MAX_WATCHES)
+		err("watch_fd: too many watches\n");
+
+	watches[watch_count++] = (struct watch){ fd, events, ready };
+}
+
+// poll() skips negative fds
+void unwatch_fd(int fd) {
+	for (int i = 0; i < watch_count; i++)
+		if (watches[i].fd == fd)
+			watches[i].fd = -1;
+}
+
+// Sleep until something happens to a child, or for timeout milliseconds (-1 for no limit)
+// Wakes up early for services that are due to be restarted
+void wait_for_events(int timeout) {
+	struct pollfd fds[1 + MAX_WATCHES] = { { signal_fd, POLLIN, 0 } };
+
+	for (int i = 0; i < watch_count; i++)
+		fds[1 + i] = (struct pollfd){ watches[i].fd, watches[i].events, 0 };
+
+	int next = start_waiting_services();
+	int kill_next = kill_stuck_services();
+
+	if (kill_next >= 0 && (next < 0 || kill_next < next))
+		next = kill_next;
+
+	if (next >= 0 && (timeout < 0 || next < timeout))
+		timeout = next;
+
+	int rc = poll(fds, 1 + watch_count, timeout);
+
+	if (rc < 0)
+		return;
+
+	for (int i = 0; i < watch_count; i++)
+		if (fds[1 + i].revents)
+			watches[i].ready();
+
+	// Signals of the same kind coalesce, one read is not one child
+	// Just empty the queue and reap everything there is
+	if (fds[0].revents & POLLIN) {
+		struct signalfd_siginfo info[4];
+		int len;
+
+		while ((len = read(signal_fd, info, sizeof(info))) > 0)
+			for (int i = 0; i < len / sizeof(info[0]); i++)
+				shutdown_requested(info[i].ssi_signo);
+	}
+
+	reap_children();
+	start_waiting_services();
+	kill_stuck_services();
+}
+
+
+//
+// Control socket
+//
+
+// PID 1 takes requests on /run/micro_init/control, i.e. `micro_ctl restart sshd` or `micro_ctl status`
+// micro_ctl is a symlink to this same binary, main() tells the two apart by argv[0]
+//
+// A request is one datagram and so is the answer, which comes straight from the service table
+// Nothing gets forked, and a client that never reads its answer can't hold PID 1 up
+// Only root can write to the socket, that is all the access control there is
+#define CONTROL_PATH "/run/micro_init/control"
+
+#define CONTROL_START 1
+#define CONTROL_STOP 2
+#define CONTROL_RESTART 3
+#define CONTROL_STATUS 4	// Of every service if the name is empty
+#define CONTROL_SHUTDOWN 5	// arg is one of LINUX_REBOOT_CMD_*
+
+struct control_request {
+	uint32_t command;
+	uint32_t arg;
+	char name[24];
+};
+
+struct control_status {
+	char name[24];
+	int32_t pid;
+	int32_t state;		// SERVICE_*
+	int32_t restarts;
+	int32_t backoff;
+};
+
+struct control_response {
+	int32_t error;		// 0 or an errno value
+	int32_t count;		// Entries of services[] that are filled in, only these are sent
+	struct control_status services[MAX_SERVICES];
+};
+
+int control_fd = -1;
+
+struct service* find_service(char* name) {
+	for (int i = 0; i < service_count; i++)
+		if (!strcmp(services[i].name, name))
+			return &services[i];
+
+	return NULL;
+}
+
+// The pid can't go to another process before PID 1 reaps this one
+// SIGKILL follows from wait_for_events() if it doesn't go away in time
+void stop_service(struct service* service, int requested) {
+	service->requested = requested;
+	service->kill_at = now_ms() + stop_timeout;
+	kill(service->pid, SIGTERM);
+}
+
+void control_status(struct service* service, struct control_response* response) {
+	struct control_status* status = &response->services[response->count++];
+
+	sformat(status->name, sizeof(status->name), "%s", service->name);
+	status->pid = service->pid;
+	status->state = service->state;
+	status->restarts = service->restarts;
+	status->backoff = service->backoff;
+}
+
+// Returns 0 or an errno value
+int control_command(struct control_request* request, struct control_response* response) {
+	struct service* service = NULL;
+	int command = request->command;
+
+	request->name[sizeof(request->name) - 1] = 0;
+
+	if (request->name[0] && !(service = find_service(request->name)))
+		return ENOENT;
+
+	if (command == CONTROL_STATUS) {
+		for (int i = 0; i < service_count; i++)
+			if (!service || service == &services[i])
+				control_status(&services[i], response);
+
+		return 0;
+	}
+
+	if (command == CONTROL_SHUTDOWN) {
+		if (request->arg != LINUX_REBOOT_CMD_RESTART && request->arg != LINUX_REBOOT_CMD_POWER_OFF && request->arg != LINUX_REBOOT_CMD_HALT)
+			return EINVAL;
+
+		shutdown_cmd = request->arg;
+
+		return 0;
+	}
+
+	if (!service || command < CONTROL_START || command > CONTROL_RESTART)
+		return EINVAL;
+
+	if (service->state == SERVICE_RUNNING) {
+		if (command == CONTROL_START)
+			return EALREADY;
+
+		// Carried out once it exits
+		stop_service(service, command == CONTROL_STOP ? STOP_REQUESTED : RESTART_REQUESTED);
+
+		return 0;
+	}
+
+	// Waiting, failed, idle or stopped
+	if (command == CONTROL_STOP) {
+		service->state = SERVICE_STOPPED;
+		write_service_status();
+
+		return 0;
+	}
+
+	// Asking by hand is a fresh start
+	service->backoff = 0;
+	service->window_restarts = 0;
+
+	start_service(service);
+
+	return service->pid ? 0 : EAGAIN;
+}
+
+void control_ready() {
+	static struct control_response response;
+	struct control_request request;
+	struct sockaddr_un peer;
+	int len;
+
+	struct iovec iov = { &request, sizeof(request) };
+	struct msghdr msg = { &peer, sizeof(peer), &iov, 1 };
+
+	while ((len = recvmsg(control_fd, &msg, 0)) >= 0) {
+		int peer_len = msg.msg_namelen;
+
+		msg.msg_namelen = sizeof(peer);
+
+		if (len != sizeof(request))
+			continue;
+
+		response.count = 0;
+		response.error = control_command(&request, &response);
+
+		struct iovec reply_iov = { &response, sizeof(response) - sizeof(response.services) + response.count * sizeof(response.services[0]) };
+		struct msghdr reply = { &peer, peer_len, &reply_iov, 1 };
+
+		sendmsg(control_fd, &reply, MSG_DONTWAIT);
+	}
+}
+
+void start_control() {
+	struct sockaddr_un addr = { AF_UNIX, CONTROL_PATH };
+
+	mkdir("/run/micro_init", 0755);
+
+	// Would end up on the boot medium
+	if (!log_persist) {
+		warn("No /run, no control socket\n");
+		return;
+	}
+
+	// Left behind by the previous boot or by PID 1 before the switch
+	unlink(CONTROL_PATH);
+
+	control_fd = socket(AF_UNIX, SOCK_DGRAM | O_NONBLOCK | O_CLOEXEC, 0);
+
+	int rc = control_fd < 0 || bind(control_fd, &addr, sizeof(addr)) || chmod(CONTROL_PATH, 0600);
+
+	if (rc) {
+		warn("Failed to set up the control socket\n");
+
+		if (control_fd >= 0)
+			close(control_fd);
+
+		control_fd = -1;
+		return;
+	}
+
+	watch_fd(control_fd, POLLIN, control_ready);
+}
+
+// `micro_ctl status [name]`
+// `micro_ctl start|stop|restart name`
+// `micro_ctl shutdown [reboot|halt]` (powers off by default)
+int control_client(int argc, char* argv[]) {
+	static struct control_response response;
+	char* commands[] = { [CONTROL_START] = "start", "stop", "restart", "status", "shutdown" };
+	char* errors[] = { [ENOENT] = "No such service", [EAGAIN] = "Failed to start", [EINVAL] = "Invalid request", [EALREADY] = "Already running" };
+	struct control_request request = { 0 };
+	struct sockaddr_un addr = { AF_UNIX, CONTROL_PATH };
+
+	// Binding nothing but the family gets an abstract address from the kernel, for PID 1 to answer to
+	struct sockaddr_un self = { AF_UNIX };
+
+	for (int i = CONTROL_START; i <= CONTROL_SHUTDOWN && argc > 1; i++)
+		if (!strcmp(argv[1], commands[i]))
+			request.command = i;
+
+	if (!request.command || (argc > 2 && strlen(argv[2]) >= sizeof(request.name))) {
+		printf("Usage: micro_ctl status [name] | start|stop|restart name | shutdown [reboot|halt]\n");
+		return 2;
+	}
+
+	if (request.command == CONTROL_SHUTDOWN) {
+		request.arg = LINUX_REBOOT_CMD_POWER_OFF;
+
+		if (argc > 2 && !strcmp(argv[2], "reboot"))
+			request.arg = LINUX_REBOOT_CMD_RESTART;
+
+		if (argc > 2 && !strcmp(argv[2], "halt"))
+			request.arg = LINUX_REBOOT_CMD_HALT;
+	} else if (argc > 2) {
+		strcpy(request.name, argv[2]);
+	}
+
+	int fd = socket(AF_UNIX, SOCK_DGRAM | O_CLOEXEC, 0);
+
+	if (fd < 0 || bind(fd, &self, sizeof(self.sun_family)) || connect(fd, &addr, sizeof(addr))) {
+		warn("Can't reach PID 1 at " CONTROL_PATH "\n");
+		return 1;
+	}
+
+	struct pollfd fds[1] = { { fd, POLLIN, 0 } };
+
+	write(fd, &request, sizeof(request));
+
+	int len = poll(fds, 1, 5000) > 0 ? read(fd, &response, sizeof(response)) : -1;
+
+	if (len < (int)(sizeof(response) - sizeof(response.services))) {
+		warn("No answer from PID 1\n");
+		return 1;
+	}
+
+	if (response.error) {
+		int known = response.error < sizeof(errors) / sizeof(errors[0]) && errors[response.error];
+
+		warn("%s\n", known ? errors[response.error] : "Failed");
+		return 1;
+	}
+
+	// Same columns as /run/micro_init/services
+	for (int i = 0; i < response.count; i++) {
+		struct control_status* status = &response.services[i];
+
+		printf("%s %d %s %d %d\n", status->name, status->pid, service_states[status->state], status->restarts, status->backoff);
+	}
+
+	return 0;
+}
+
+
+//
+// Disk image mounts
+//
+
+// include/uapi/linux/loop.h
+#define LOOP_CTL_GET_FREE 0x4C82
+#define LOOP_SET_FD 0x4C00
+#define LOOP_CLR_FD 0x4C01
+#define LOOP_SET_STATUS64 0x4C04
+#define LOOP_SET_DIRECT_IO 0x4C08
+#define LOOP_CONFIGURE 0x4C0A
+
+// include/uapi/linux/mount.h
+#define MS_RDONLY 1
+#define MS_BIND 4096
+
+// `mi_root_image=/root.squashfs` to boot from something else
+#define IMAGE_PATH "/ext2.img"
+#define TARGET_DIRECTORY "/newroot"
+
+// Tell the filesystem in an image by the magic number in its superblock
+// block_size gets the size of its blocks, to let the loop device pass whole blocks through instead of 512 byte sectors
+// (0 where that doesn't apply)
+// Returns the type to mount it as, NULL if unknown
+char* image_probe(char* path, int* block_size) {
+	uint8_t sb[2048];
+	char* type = NULL;
+	int size = 0;
+
+	*block_size = 0;
+
+	int fd = open(path, O_RDONLY | O_CLOEXEC, 0);
+
+	if (fd < 0)
+		return NULL;
+
+	int len = read(fd, sb, sizeof(sb));
+
+	close(fd);
+
+	if (len < sizeof(sb))
+		return NULL;
+
+	// ext2: s_magic at 56 and s_log_block_size at 24 in a superblock 1024 bytes in
+	if (sb[1080] == 0x53 && sb[1081] == 0xEF) {
+		type = "ext2";
+		size = 1024 << sb[1048];
+	}
+
+	// squashfs: "hsqs" right at the start; its blocks are compressed and have nothing to do with the disk
+	if (!memcmp(sb, "hsqs", 4))
+		type = "squashfs";
+
+	// erofs: 0xE0F5E1E2 at 0 and blkszbits at 12 in a superblock 1024 bytes in
+	if (sb[1024] == 0xE2 && sb[1025] == 0xE1 && sb[1026] == 0xF5 && sb[1027] == 0xE0) {
+		type = "erofs";
+		size = 1 << sb[1036];
+	}
+
+	// The loop device can't go over a page
+	if (size <= page_size)
+		*block_size = size;
+
+	return type;
+}
+
+// Attach the image to a loop device with LOOP_CONFIGURE:
+// - LO_FLAGS_DIRECT_IO reads straight from the FAT32 file, so the image isn't cached twice
+// - LO_FLAGS_READ_ONLY since the image is mounted read-only anyway
+// - LO_FLAGS_AUTOCLEAR frees the loop device once it is unmounted
+// `mi_loop_read_ahead_kb=` sets the read-ahead of the loop device
+// Returns 0 on success
+int loop_configure(int loop_fd, char* path) {
+	struct loop_config config = { 0 };
+	int read_ahead_kb = boot_option_int("mi_loop_read_ahead_kb", 0);
+	int block_size = 0;
+
+	int image_fd = open(path, O_RDONLY | O_DIRECT | O_CLOEXEC, 0);
+
+	config.info.lo_flags = LO_FLAGS_READ_ONLY | LO_FLAGS_AUTOCLEAR | LO_FLAGS_DIRECT_IO;
+
+	// Not every filesystem does O_DIRECT
+	if (image_fd < 0) {
+		image_fd = open(path, O_RDONLY | O_CLOEXEC, 0);
+		config.info.lo_flags &= ~LO_FLAGS_DIRECT_IO;
+	}
+
+	if (image_fd < 0)
+		return -1;
+
+	config.fd = image_fd;
+
+	image_probe(path, &block_size);
+	config.block_size = block_size;
+
+	int rc = ioctl(loop_fd, LOOP_CONFIGURE, &config);
+
+	// Kernels before 5.8 take three calls to get the same
+	if (rc && (errno == EINVAL || errno == ENOTTY)) {
+		rc = ioctl(loop_fd, LOOP_SET_FD, (void*)(long)image_fd);
+
+		if (!rc) {
+			ioctl(loop_fd, LOOP_SET_STATUS64, &config.info);
+			ioctl(loop_fd, LOOP_SET_DIRECT_IO, (void*)(long)!!(config.info.lo_flags & LO_FLAGS_DIRECT_IO));
+		}
+	}
+
+	// The loop device holds its own reference
+	close(image_fd);
+
+	// In 512 byte sectors
+	if (!rc && read_ahead_kb)
+		ioctl(loop_fd, BLKRASET, (void*)(long)(read_ahead_kb * 2));
+
+	return rc;
+}
+
+// Another loop user can grab the same free device between LOOP_CTL_GET_FREE and LOOP_CONFIGURE
+#define LOOP_ATTACH_ATTEMPTS 8
+
+// Find a free loop device and attach the image to it
+// The device path is written to path, which must fit `/dev/loop` and a number
+// Returns the open loop device, or -1
+int loop_attach(int ctl_fd, char* image, char* path) {
+	int loop_fd = -1;
+
+	for (int attempt = 0; attempt < LOOP_ATTACH_ATTEMPTS; attempt++) {
+		int loop_num = ioctl(ctl_fd, LOOP_CTL_GET_FREE, NULL);
+
+		if (loop_num < 0)
+			break;
+
+		strcpy(path, "/dev/loop");
+		strcpy(path + strlen(path), ltoa(loop_num));
+
+		loop_fd = open(path, O_RDWR | O_CLOEXEC, 0);
+
+		if (loop_fd < 0)
+			break;
+
+		if (!loop_configure(loop_fd, image))
+			break;
+
+		close(loop_fd);
+		loop_fd = -1;
+
+		// Lost the race, ask for another one
+		if (errno != EBUSY)
+			break;
+	}
+
+	return loop_fd;
+}
+
+// The root image comes first, the rest get mounted inside of it
+// `mi_images=/app.img:/newroot/opt/app,/data.img:/newroot/data` adds more
+#define MAX_IMAGES 8
+
+struct image {
+	char* path;
+	char* target;
+	char* type;
+	char loop_path[32];
+	int loop_fd;
+};
+
+struct image images[MAX_IMAGES] = {
+	{ IMAGE_PATH, TARGET_DIRECTORY },
+};
+
+int image_count = 1;
+
+void read_image_options() {
+	static char buf[256];
+	char* option = boot_option("mi_images");
+
+	if (!option || strlen(option) >= sizeof(buf))
+		return;
+
+	strcpy(buf, option);
+
+	for (char* entry = buf; *entry && image_count < MAX_IMAGES; ) {
+		char* next = entry;
+
+		while (*next && *next != ',')
+			next++;
+
+		if (*next)
+			*next++ = 0;
+
+		char* target = entry;
+
+		while (*target && *target != ':')
+			target++;
+
+		if (*target) {
+			*target++ = 0;
+			images[image_count++] = (struct image){ entry, target };
+		}
+
+		entry = next;
+	}
+}
+
+// squashfs and erofs can't be written to at all, so by default they get a writable layer in RAM on top
+// `mi_overlay=1` does the same for an ext2 image, `mi_overlay=0` leaves the root read-only
+// `mi_overlay_size=` caps that layer, 25% of the RAM by default
+int root_overlay(char* type) {
+	return boot_option_int("mi_overlay", strcmp(type, "ext2") != 0);
+}
+
+// Everything lives in one tmpfs on the target directory, before the overlay covers it:
+// /newroot/lower	The image
+// /newroot/upper	Changes
+// /newroot/work	Scratch space for overlayfs
+int mount_root_overlay(struct image* image) {
+	char options[64];
+	char* size = boot_option("mi_overlay_size");
+
+	// Anything that fills the buffer up has been cut short
+	if (size && sformat(options, sizeof(options), "mode=755,size=%s", size) >= sizeof(options) - 1) {
+		warn("mi_overlay_size= is too long, using the default\n");
+		size = NULL;
+	}
+
+	if (!size)
+		strcpy(options, "mode=755,size=25%");
+
+	int rc = mount("tmpfs", TARGET_DIRECTORY, "tmpfs", 0, options);
+
+	if (rc)
+		return rc;
+
+	mkdir(TARGET_DIRECTORY "/lower", 0755);
+	mkdir(TARGET_DIRECTORY "/upper", 0755);
+	mkdir(TARGET_DIRECTORY "/work", 0755);
+
+	rc = mount(image->loop_path, TARGET_DIRECTORY "/lower", image->type, MS_RDONLY, NULL);
+
+	if (rc)
+		return rc;
+
+	return mount("overlay", TARGET_DIRECTORY, "overlay", 0,
+		"lowerdir=" TARGET_DIRECTORY "/lower,"
+		"upperdir=" TARGET_DIRECTORY "/upper,"
+		"workdir=" TARGET_DIRECTORY "/work");
+}
+
+// Attach every image first, then mount them in order
+// Only the root image is required
+void mount_images() {
+	int ctl_fd = open("/dev/loop-control", O_RDWR | O_CLOEXEC, 0);
+
+	if (ctl_fd < 0)
+		err(	"Failed to open /dev/loop-control;\n"
+			"1. Is folder `dev` missing on real root and devtmpfs didn't initialize?\n"
+			"2. Is loop device support compiled in?\n"					);
+
+	read_image_options();
+
+	if (boot_option("mi_root_image"))
+		images[0].path = boot_option("mi_root_image");
+
+	for (int i = 0; i < image_count; i++) {
+		struct image* image = &images[i];
+
+		image->loop_fd = loop_attach(ctl_fd, image->path, image->loop_path);
+
+		if (image->loop_fd < 0 && i == 0)
+			err("Failed to attach [%s] to a loop device!\n", image->path);
+
+		if (image->loop_fd < 0)
+			warn("Failed to attach [%s] to a loop device\n", image->path);
+	}
+
+	close(ctl_fd);
+
+	for (int i = 0; i < image_count; i++) {
+		struct image* image = &images[i];
+
+		if (image->loop_fd < 0)
+			continue;
+
+		int block_size = 0;
+		int rc = -1;
+
+		image->type = image_probe(image->path, &block_size);
+
+		if (!image->type)
+			warn("[%s] doesn't look like ext2, squashfs or erofs\n", image->path);
+		else if (i == 0 && root_overlay(image->type))
+			rc = mount_root_overlay(image);
+		else
+			rc = mount(image->loop_path, image->target, image->type, MS_RDONLY, NULL);
+
+		// With LO_FLAGS_AUTOCLEAR, this detaches the loop device if the mount failed
+		close(image->loop_fd);
+
+		if (rc && i == 0)
+			err("Failed to mount the loop into [%s]!\n", image->target);
+
+		if (rc)
+			warn("Failed to mount [%s] into [%s]\n", image->path, image->target);
+	}
+}
+
+//
+// Sysfs mounts
+//
+
+// Kernels without CONFIG_DEVTMPFS_MOUNT hand over an empty /dev
+// Mount it here, before anything gets a chance to look for /dev/console or /dev/null
+void mount_devtmpfs() {
+	char buf[256];
+	int empty = 1;
+
+	int fd = open("/dev", O_RDONLY | O_DIRECTORY | O_CLOEXEC, 0);
+
+	if (fd < 0)
+		return;
+
+	int len = getdents64(fd, (void*)buf, sizeof(buf));
+
+	for (int pos = 0; pos < len; pos += ((struct linux_dirent64*)(buf + pos))->d_reclen) {
+		char* name = ((struct linux_dirent64*)(buf + pos))->d_name;
+
+		if (strcmp(name, ".") && strcmp(name, ".."))
+			empty = 0;
+	}
+
+	close(fd);
+
+	if (!empty)
+		return;
+
+	int rc = mount("devtmpfs", "/dev", "devtmpfs", MS_NOSUID, "mode=755");
+
+	if (rc)
+		return;
+
+	// The kernel couldn't open the console without a /dev either
+	if (sys_write(1, "", 0) == -EBADF) {
+		fd = open("/dev/console", O_RDWR, 0);
+
+		if (fd >= 0) {
+			dup2(fd, 0);
+			dup2(fd, 1);
+			dup2(fd, 2);
+
+			if (fd > 2)
+				close(fd);
+		}
+	}
+
+	printf("Mounted devtmpfs on [/dev]\n");
+}
+
+// What to mount and where, in order
+// Parents come before the mounts that go inside them
+struct mount_entry {
+	char* name;		// `mi_mount_<name>=` replaces the options
+	char* source;
+	char* target;
+	char* type;
+	unsigned long flags;	// MS_RDONLY, MS_NOSUID, MS_NODEV, MS_NOEXEC, MS_NOATIME
+	char* options;		// Comma separated, as in fstab
+	int mode;		// Create the target first, with this mode, unless 0
+};
+
+// See Void Linux init scripts to get an insight into starting a Linux system:
+// https://github.com/void-linux/void-runit/blob/master/core-services/00-pseudofs.sh
+//
+// /proc		Task managers (And a ton of other stuff) will not work without this mounted
+// /sys			`lsblk` and `df` (And a ton of other stuff) will not work without this mounted
+// /dev/shm		Ramdisk
+// /dev/pts		Pseudoterminals
+// /run			Repicates the mount structure WSL1 uses; `sshd` and `watchdog` want it to store temporary files
+// /var/log		Log to RAM, no way to persist logs on read-only system; required by `watchdog` and used by `apt`
+//
+// Without a size= every tmpfs may take half of the RAM, and without nr_inodes= a runaway logger can fill it with empty files
+// huge=within_size backs big enough shared memory segments with transparent huge pages
+// For example, to give /var/log more room: `mi_mount_var_log=mode=755,size=25%,nr_inodes=256k`
+struct mount_entry mounts[] = {
+	{ "proc",	"proc",		"/proc",	"proc",		MS_NOSUID | MS_NODEV | MS_NOEXEC,	NULL,						0 },
+	{ "sys",	"sysfs",	"/sys",		"sysfs",	MS_NOSUID | MS_NODEV | MS_NOEXEC,	NULL,						0 },
+	{ "shm",	"shm",		"/dev/shm",	"tmpfs",	MS_NOSUID | MS_NODEV,			"mode=1777,size=25%,huge=within_size",		0777 },
+	{ "pts",	"devpts",	"/dev/pts",	"devpts",	MS_NOSUID | MS_NOEXEC,			NULL,						0755 },
+	{ "run",	"tmpfs",	"/run",		"tmpfs",	MS_NOSUID | MS_NODEV,			"mode=755,size=10%,nr_inodes=64k",		0 },
+	{ "run_lock",	"tmpfs",	"/run/lock",	"tmpfs",	MS_NOSUID | MS_NODEV | MS_NOEXEC,	"mode=1777,size=5m,nr_inodes=4k",		0777 },
+	{ "run_shm",	"shm",		"/run/shm",	"tmpfs",	MS_NOSUID | MS_NODEV,			"mode=1777,size=25%,huge=within_size",		0777 },
+	{ "run_user",	"tmpfs",	"/run/user",	"tmpfs",	MS_NOSUID | MS_NODEV,			"mode=755,size=10%,nr_inodes=64k",		0755 },
+	{ "var_log",	"tmpfs",	"/var/log",	"tmpfs",	MS_NOSUID | MS_NODEV,			"mode=755,size=10%,nr_inodes=64k",		0 },
+};
+
+#define MOUNT_COUNT (sizeof(mounts) / sizeof(mounts[0]))
+
+// Cleared the first time the kernel turns out to be older than 5.2
+int new_mount_api = 1;
+
+// Mount using fsopen() -> fsconfig() -> fsmount() -> move_mount()
+// Every option is checked on its own, and the kernel explains what it didn't like through the fs context
+// An option the kernel rejects is left out, i.e. huge= on a kernel without transparent huge pages
+// Returns -errno, -ENOSYS if the kernel doesn't have the new mount API
+int mount_entry_new(struct mount_entry* entry) {
+	// Cut up in place below, so it needs a copy as long as the string
+	char options[entry->options ? strlen(entry->options) + 1 : 1];
+	int attr = 0;
+	int rc = 0;
+
+	if (entry->flags & MS_RDONLY) attr |= MOUNT_ATTR_RDONLY;
+	if (entry->flags & MS_NOSUID) attr |= MOUNT_ATTR_NOSUID;
+	if (entry->flags & MS_NODEV) attr |= MOUNT_ATTR_NODEV;
+	if (entry->flags & MS_NOEXEC) attr |= MOUNT_ATTR_NOEXEC;
+	if (entry->flags & MS_NOATIME) attr |= MOUNT_ATTR_NOATIME;
+
+	strcpy(options, entry->options ? entry->options : "");
+
+	int fs = sys_fsopen(entry->type, FSOPEN_CLOEXEC);
+
+	if (fs < 0)
+		return fs;
+
+	rc = sys_fsconfig(fs, FSCONFIG_SET_STRING, "source", entry->source, 0);
+
+	// `key=value` or just `key`
+	char* key = options;
+
+	while (!rc && *key) {
+		char* next = key;
+
+		while (*next && *next != ',')
+			next++;
+
+		if (*next)
+			*next++ = 0;
+
+		char* value = key;
+
+		while (*value && *value != '=')
+			value++;
+
+		if (*value) {
+			*value++ = 0;
+			rc = sys_fsconfig(fs, FSCONFIG_SET_STRING, key, value, 0);
+		} else {
+			rc = sys_fsconfig(fs, FSCONFIG_SET_FLAG, key, NULL, 0);
+		}
+
+		// The context is still good, only the one option didn't make it in
+		if (rc == -EINVAL) {
+			warn("[%s] rejected [%s], mounting without it\n", entry->target, key);
+			rc = 0;
+		}
+
+		key = next;
+	}
+
+	if (!rc)
+		rc = sys_fsconfig(fs, FSCONFIG_CMD_CREATE, NULL, NULL, 0);
+
+	if (rc) {
+		close(fs);
+		return rc;
+	}
+
+	int mnt = sys_fsmount(fs, FSMOUNT_CLOEXEC, attr);
+
+	close(fs);
+
+	if (mnt < 0)
+		return mnt;
+
+	rc = sys_move_mount(mnt, "", AT_FDCWD, entry->target, MOVE_MOUNT_F_EMPTY_PATH);
+
+	close(mnt);
+
+	return rc;
+}
+
+// Returns -errno
+int mount_entry(struct mount_entry* entry) {
+	if (new_mount_api) {
+		int rc = mount_entry_new(entry);
+
+		if (rc != -ENOSYS)
+			return rc;
+
+		new_mount_api = 0;
+	}
+
+	return mount(entry->source, entry->target, entry->type, entry->flags, entry->options) ? -errno : 0;
+}
+
+// Copy the comma separated options to out, except for `key` and `key=...`
+// Returns 1 if it was there
+int drop_option(char* out, char* options, char* key) {
+	int len = strlen(key);
+	int dropped = 0;
+	int pos = 0;
+
+	while (*options) {
+		char* next = options;
+
+		while (*next && *next != ',')
+			next++;
+
+		if (!strncmp(options, key, len) && (options[len] == '=' || options + len == next)) {
+			dropped = 1;
+		} else {
+			if (pos)
+				out[pos++] = ',';
+
+			memcpy(out + pos, options, next - options);
+			pos += next - options;
+		}
+
+		options = *next ? next + 1 : next;
+	}
+
+	out[pos] = 0;
+
+	return dropped;
+}
+
+// Is path inside of dir?
+int path_under(char* path, char* dir) {
+	int len = strlen(dir);
+
+	return strncmp(path, dir, len) == 0 && path[len] == '/';
+}
+
+// Mount everything from the table in one pass
+// A failed mount is not fatal, but whatever was supposed to go inside it gets skipped
+void mount_filesystems() {
+	char* failed = NULL;
+	int run_mounted = 0;
+
+	for (int i = 0; i < MOUNT_COUNT; i++) {
+		struct mount_entry* entry = &mounts[i];
+		char option[64] = "mi_mount_";
+
+		strcpy(option + strlen(option), entry->name);
+
+		if (boot_option(option))
+			entry->options = boot_option(option);
+
+		if (failed && path_under(entry->target, failed))
+			continue;
+
+		if (entry->mode && mkdir(entry->target, entry->mode) && errno != EEXIST)
+			warn("Failed to create [%s]\n", entry->target);
+
+		int rc = mount_entry(entry);
+
+		// Only with mount(), which doesn't say which option it didn't like
+		// huge= is the one that comes and goes with the kernel config, so that one goes and size= and mode= stay
+		if (rc == -EINVAL && entry->options) {
+			char options[strlen(entry->options) + 1];
+			struct mount_entry retry = *entry;
+
+			retry.options = options;
+
+			if (drop_option(options, entry->options, "huge")) {
+				warn("[%s] rejected [%s], mounting without huge=\n", entry->target, entry->options);
+				rc = mount_entry(&retry);
+			}
+		}
+
+		if (rc) {
+			warn(	"Error mounting [%s]\n"
+				"Perhaps %s is missing in the rootfs you're using?\n", entry->target, entry->target );
+			failed = entry->target;
+			continue;
+		}
+
+		if (strcmp(entry->target, "/run") == 0)
+			run_mounted = 1;
+	}
+
+	// Nowhere to mirror the boot log into without /run
+	if (run_mounted)
+		log_ring_persist();
+}
+
+//
+// zram
+//
+
+// Compressed RAM disks, roughly doubling the memory of small machines
+//
+// `mi_zram_swap=512M` adds a swap device of that size
+// `mi_zram_var_log=64M` puts /var/log on an ext2 formatted one, over the tmpfs
+// `mi_zram_algorithm=zstd` picks the compression, see /sys/block/zram0/comp_algorithm for what the kernel has
+
+// include/linux/swap.h
+#define SWAP_FLAG_PREFER	0x8000
+#define SWAP_FLAG_PRIO_MASK	0x7fff
+#define SWAP_FLAG_DISCARD	0x10000
+
+// Create and size a new zram device
+// Returns its number, or -1
+int zram_create(char* size) {
+	char buf[64];
+	char* algorithm = boot_option("mi_zram_algorithm");
+
+	if (read_file("/sys/class/zram-control/hot_add", buf, sizeof(buf)) <= 0) {
+		warn("zram: failed to add a device; is the module loaded?\n");
+		return -1;
+	}
+
+	int num = atol(buf);
+
+	// Can't be changed once the disk has a size
+	sformat(buf, sizeof(buf), "/sys/block/zram%d/comp_algorithm", num);
+
+	if (algorithm)
+		echo(algorithm, buf);
+
+	sformat(buf, sizeof(buf), "/sys/block/zram%d/disksize", num);
+
+	if (echo(size, buf))
+		return -1;
+
+	return num;
+}
+
+// Same as `mkswap`: the header goes into the first page
+// Everything else, including the UUID and the label, can stay zeroed
+// See `union swap_header` in include/linux/swap.h
+int write_swap_header(char* path, int num) {
+	char buf[64];
+	char header[page_size];
+
+	sformat(buf, sizeof(buf), "/sys/block/zram%d/disksize", num);
+
+	if (read_file(buf, buf, sizeof(buf)) <= 0)
+		return -1;
+
+	uint32_t pages = atol(buf) / page_size;
+
+	if (pages < 2)
+		return -1;
+
+	memset(header, 0, page_size);
+
+	uint32_t* info = (uint32_t*)(header + 1024);
+
+	info[0] = 1;			// version
+	info[1] = pages - 1;		// last_page
+	info[2] = 0;			// nr_badpages
+
+	memcpy(header + page_size - 10, "SWAPSPACE2", 10);
+
+	int fd = open(path, O_WRONLY | O_CLOEXEC, 0);
+
+	if (fd < 0)
+		return -1;
+
+	int rc = write(fd, header, page_size);
+
+	close(fd);
+
+	return rc == page_size ? 0 : -1;
+}
+
+void setup_zram_swap() {
+	char* size = boot_option("mi_zram_swap");
+	char path[32];
+
+	if (!size)
+		return;
+
+	int num = zram_create(size);
+
+	if (num < 0)
+		return;
+
+	sformat(path, sizeof(path), "/dev/zram%d", num);
+
+	if (write_swap_header(path, num)) {
+		warn("zram: failed to write a swap header to [%s]\n", path);
+		return;
+	}
+
+	// Preferred over any disk swap; discard gives the memory of freed pages back right away
+	int rc = swapon(path, SWAP_FLAG_PREFER | (100 & SWAP_FLAG_PRIO_MASK) | SWAP_FLAG_DISCARD);
+
+	if (rc) warn("zram: swapon [%s] failed\n", path);
+}
+
+// Set by exec_zram_mkfs(), mounted by mount_zram_var_log()
+char zram_var_log[32] = "";
+
+// Formatting a filesystem is best left to e2fsprogs
+pid_t exec_zram_mkfs() {
+	char* size = boot_option("mi_zram_var_log");
+
+	if (!size)
+		return -1;
+
+	int num = zram_create(size);
+
+	if (num < 0)
+		return -1;
+
+	sformat(zram_var_log, sizeof(zram_var_log), "/dev/zram%d", num);
+
+	char* argv[] = { "mke2fs", "-q", "-t", "ext2", "-m", "0", zram_var_log, NULL };
+
+	return spawn("/sbin/mke2fs", argv, service_envp, SPAWN_NULL_STDIN, NULL);
+}
+
+// Goes over the tmpfs from the mount table, so /var/log stays usable if this fails
+// Anything logged before this point stays hidden underneath
+void mount_zram_var_log() {
+	struct mount_entry entry = { "zram_var_log", zram_var_log, "/var/log", "ext2", MS_NOSUID | MS_NODEV | MS_NOATIME, NULL, 0 };
+
+	if (!zram_var_log[0])
+		return;
+
+	int rc = mount_entry(&entry);
+
+	if (rc) warn("zram: failed to mount [%s] into [/var/log]\n", zram_var_log);
+}
+
+//
+// Symlinks
+//
+
+// The links udev would otherwise make; devtmpfs only has device nodes
+// /dev/fd is required for process substitution to work, i.e. bash <(echo 123)
+// Also used by certain programs like wg-quick
+char* dev_links[][2] = {
+	{ "/proc/self/fd",	"/dev/fd" },
+	{ "/proc/self/fd/0",	"/dev/stdin" },
+	{ "/proc/self/fd/1",	"/dev/stdout" },
+	{ "/proc/self/fd/2",	"/dev/stderr" },
+	{ "/proc/kcore",	"/dev/core" },
+};
+
+void symlink_dev() {
+	for (int i = 0; i < sizeof(dev_links) / sizeof(dev_links[0]); i++) {
+		int rc = symlink(dev_links[i][0], dev_links[i][1]);
+
+		if (rc && errno != EEXIST)
+			warn("Error symlinking [%s] -> [%s]\n", dev_links[i][1], dev_links[i][0]);
+	}
+}
+
+
+//
+// Switch root
+//
+
+// Executables have a hardcoded list of paths with the .so files they need
+// Without switching the root kernel's ELF loader will be unable to find them
+//
+// Unlike a chroot, nothing of the old root stays reachable (i.e. through /proc/1/root),
+// so the FAT32 filesystem and whatever it holds can go away once the images are unmounted
+
+// Mounts that come along into the new root, if they are mounted already
+char* moved_mounts[] = { "/dev", "/proc", "/sys", "/run" };
+
+#define MNT_DETACH 2
+
+// Delete everything in the current directory, the way switch_root from util-linux does
+// Stays on the given device, so the new root and anything else mounted is left alone
+void remove_tree(dev_t dev) {
+	char buf[1024];
+	struct stat st;
+	int len;
+
+	int fd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC, 0);
+
+	if (fd < 0)
+		return;
+
+	while ((len = getdents64(fd, (void*)buf, sizeof(buf))) > 0) {
+		for (int pos = 0; pos < len; pos += ((struct linux_dirent64*)(buf + pos))->d_reclen) {
+			struct linux_dirent64* entry = (struct linux_dirent64*)(buf + pos);
+
+			if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, ".."))
+				continue;
+
+			if (entry->d_type != DT_DIR) {
+				unlink(entry->d_name);
+				continue;
+			}
+
+			if (stat(entry->d_name, &st) || st.st_dev != dev || chdir(entry->d_name))
+				continue;
+
+			remove_tree(dev);
+			chdir("..");
+			rmdir(entry->d_name);
+		}
+	}
+
+	close(fd);
+}
+
+// include/uapi/linux/magic.h
+#define RAMFS_MAGIC 0x858458f6
+#define TMPFS_MAGIC 0x01021994
+
+// Never empty anything that isn't in RAM
+int is_initramfs(char* path) {
+	struct statfs fs;
+
+	if (statfs(path, &fs))
+		return 0;
+
+	return fs.f_type == RAMFS_MAGIC || fs.f_type == TMPFS_MAGIC;
+}
+
+void switch_root() {
+	struct stat st;
+	int rc = 0;
+
+	for (int i = 0; i < sizeof(moved_mounts) / sizeof(moved_mounts[0]); i++) {
+		char target[32] = TARGET_DIRECTORY;
+
+		strcpy(target + strlen(target), moved_mounts[i]);
+
+		// EINVAL: not a mount point, so nothing to move
+		rc = mount(moved_mounts[i], target, NULL, MS_MOVE, NULL);
+
+		if (rc && errno != EINVAL)
+			warn("Failed to move [%s] into [%s]\n", moved_mounts[i], target);
+	}
+
+	if (chdir(TARGET_DIRECTORY))
+		err("Failed to enter [" TARGET_DIRECTORY "]\n");
+
+	// The old root ends up stacked on top of the new one, and then gets detached
+	rc = pivot_root(".", ".");
+
+	if (!rc)
+		rc = umount2(".", MNT_DETACH);
+
+	// The initramfs can't be pivoted away from
+	// Empty it to give its memory back, then mount the new root over it
+	if (rc && errno == EINVAL && is_initramfs("/") && !stat("/", &st)) {
+		chdir("/");
+		remove_tree(st.st_dev);
+		chdir(TARGET_DIRECTORY);
+
+		rc = mount(".", "/", NULL, MS_MOVE, NULL);
+
+		if (!rc)
+			rc = chroot(".");
+	}
+
+	if (rc)
+		err("Failed to switch to [" TARGET_DIRECTORY "]\n");
+
+	chdir("/");
+}
+
+// Mount the images, switch into them, then run micro_init again from the new root
+// so the old binary doesn't keep the old root busy either
+// The second run knows by `mi_switched=1`; an exec doesn't change the pid, so it is still PID 1
+void boot_from_image(char* argv[], char* envp[]) {
+	static char* env[64];
+	int count = 0;
+
+	if (boot_option("mi_switched"))
+		return;
+
+	mount_images();
+	switch_root();
+
+	while (envp[count] && count < 62) {
+		env[count] = envp[count];
+		count++;
+	}
+
+	env[count] = "mi_switched=1";
+
+	execve(argv[0], argv, env);
+
+	warn("Failed to run [%s] from the new root, carrying on\n", argv[0]);
+}
+
+//
+// Readahead
+//
+
+// Programs started during boot fault their binaries and libraries in a page at a time,
+// which on USB media means thousands of small random reads
+//
+// `mi_readahead=record` notes every file opened on the root filesystem until the shell is up,
+// and writes the list to /run/micro_init/readahead
+// Put that list into the image as /etc/micro_init/readahead, and from then on every boot
+// reads those files ahead right after the root is mounted, in the order they lie on the disk
+// `mi_readahead=0` skips that
+#define READAHEAD_LIST "/etc/micro_init/readahead"
+#define READAHEAD_RECORDED "/run/micro_init/readahead"
+#define READAHEAD_MAX_FILES 512
+
+char readahead_paths[32768];
+int readahead_paths_len = 0;
+
+char* readahead_files[READAHEAD_MAX_FILES];
+int readahead_count = 0;
+
+int fanotify_fd = -1;
+
+void readahead_add(char* path) {
+	int len = strlen(path);
+
+	for (int i = 0; i < readahead_count; i++)
+		if (!strcmp(readahead_files[i], path))
+			return;
+
+	if (readahead_count == READAHEAD_MAX_FILES || readahead_paths_len + len + 1 > sizeof(readahead_paths))
+		return;
+
+	readahead_files[readahead_count++] = strcpy(readahead_paths + readahead_paths_len, path);
+	readahead_paths_len += len + 1;
+}
+
+// Every event comes with the opened file, its path is in /proc
+void readahead_events() {
+	static char buf[4096];
+	char link[32];
+	char path[256];
+	int len;
+
+	while ((len = read(fanotify_fd, buf, sizeof(buf))) > 0) {
+		for (int pos = 0; pos < len; pos += ((struct fanotify_event_metadata*)(buf + pos))->event_len) {
+			struct fanotify_event_metadata* event = (struct fanotify_event_metadata*)(buf + pos);
+
+			if (event->fd < 0)
+				continue;
+
+			sformat(link, sizeof(link), "/proc/self/fd/%d", event->fd);
+
+			int path_len = readlink(link, path, sizeof(path) - 1);
+
+			// A path that fills the buffer up has been cut short
+			if (path_len > 0 && path_len < sizeof(path) - 1) {
+				path[path_len] = 0;
+				readahead_add(path);
+			}
+
+			close(event->fd);
+		}
+	}
+}
+
+void readahead_record() {
+	fanotify_fd = fanotify_init(FAN_CLASS_NOTIF | FAN_CLOEXEC | FAN_NONBLOCK, O_RDONLY | O_CLOEXEC);
+
+	if (fanotify_fd < 0) {
+		warn("readahead: fanotify is not available, nothing will be recorded\n");
+		return;
+	}
+
+	// Only the root filesystem, not /proc, /sys and friends
+	int rc = fanotify_mark(fanotify_fd, FAN_MARK_ADD | FAN_MARK_MOUNT, FAN_OPEN, AT_FDCWD, "/");
+
+	if (rc) {
+		warn("readahead: failed to watch [/]\n");
+		close(fanotify_fd);
+		fanotify_fd = -1;
+		return;
+	}
+
+	watch_fd(fanotify_fd, POLLIN, readahead_events);
+}
+
+// Called once the shell is up
+void readahead_save() {
+	if (fanotify_fd < 0)
+		return;
+
+	readahead_events();
+	unwatch_fd(fanotify_fd);
+	close(fanotify_fd);
+	fanotify_fd = -1;
+
+	int fd = open(READAHEAD_RECORDED, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+	if (fd < 0) {
+		warn("Failed to write [" READAHEAD_RECORDED "]\n");
+		return;
+	}
+
+	for (int i = 0; i < readahead_count; i++) {
+		write(fd, readahead_files[i], strlen(readahead_files[i]));
+		write(fd, "\n", 1);
+	}
+
+	close(fd);
+
+	printf("readahead: recorded %d files into [" READAHEAD_RECORDED "]\n", readahead_count);
+}
+
+struct readahead_file {
+	int fd;
+	int block;
+};
+
+// Runs as a process of its own, so nothing has to wait for it
+// That is this same binary started as `micro_readahead` through spawn(), so PID 1 is never fork()ed
+int readahead_replay() {
+	static struct readahead_file files[READAHEAD_MAX_FILES];
+	int count = 0;
+
+	int len = read_file(READAHEAD_LIST, readahead_paths, sizeof(readahead_paths));
+
+	for (char* line = readahead_paths; len > 0 && *line && readahead_count < READAHEAD_MAX_FILES; ) {
+		char* next = line;
+
+		while (*next && *next != '\n')
+			next++;
+
+		if (*next)
+			*next++ = 0;
+
+		if (*line == '/')
+			readahead_files[readahead_count++] = line;
+
+		line = next;
+	}
+
+	for (int i = 0; i < readahead_count; i++) {
+		int fd = open(readahead_files[i], O_RDONLY | O_CLOEXEC, 0);
+
+		if (fd < 0)
+			continue;
+
+		// Where the first block of the file is on the disk; 0 where the filesystem can't tell
+		int block = 0;
+
+		if (ioctl(fd, FIBMAP, &block))
+			block = 0;
+
+		// Keep it sorted as it grows
+		int pos = count++;
+
+		while (pos > 0 && files[pos - 1].block > block) {
+			files[pos] = files[pos - 1];
+			pos--;
+		}
+
+		files[pos] = (struct readahead_file){ fd, block };
+	}
+
+	for (int i = 0; i < count; i++) {
+		off_t size = lseek(files[i].fd, 0, SEEK_END);
+
+		if (size > 0)
+			readahead(files[i].fd, 0, size);
+
+		close(files[i].fd);
+	}
+
+	return 0;
+}
+
+// Needs /proc for /proc/self/exe
+void start_readahead() {
+	char* mode = boot_option("mi_readahead");
+	char* argv[] = { "micro_readahead", NULL };
+
+	if (mode && !strcmp(mode, "record")) {
+		readahead_record();
+		return;
+	}
+
+	if (mode && !strcmp(mode, "0"))
+		return;
+
+	int fd = open(READAHEAD_LIST, O_RDONLY | O_CLOEXEC, 0);
+
+	if (fd < 0)
+		return;
+
+	close(fd);
+
+	// Not waited for, it gets reaped along with the orphans
+	spawn("/proc/self/exe", argv, service_envp, SPAWN_NULL_STDIN, NULL);
+}
+
+//
+// Pinning
+//
+
+// Services and shells get restarted exactly when the machine is busiest, which is also
+// when their pages are the first to be evicted and have to come back from the USB stick
+// Mapping them into PID 1 and locking the mappings keeps them in the page cache for good
+//
+// `mi_pin=` replaces the list, comma separated, i.e. `mi_pin=/sbin/agetty,/lib/x86_64-linux-gnu/libc.so.6`
+// `mi_pin=0` pins nothing
+// The rescue shell from `mi_rescue=` is pinned as well, and so is everything the running services have mapped
+char* pin_defaults = "/sbin/agetty,/sbin/sshd,/bin/su,/bin/bash";
+
+#define PIN_MAX_FILES 64
+
+char pin_paths[4096];
+int pin_paths_len = 0;
+
+char* pin_list[PIN_MAX_FILES];
+int pin_count = 0;
+
+void pin_add(char* path) {
+	int len = strlen(path);
+
+	for (int i = 0; i < pin_count; i++)
+		if (!strcmp(pin_list[i], path))
+			return;
+
+	if (pin_count == PIN_MAX_FILES || pin_paths_len + len + 1 > sizeof(pin_paths))
+		return;
+
+	pin_list[pin_count++] = strcpy(pin_paths + pin_paths_len, path);
+	pin_paths_len += len + 1;
+}
+
+// The executables alone are not enough, every service also maps the loader and its libraries
+// /proc/<pid>/maps has them all: `address perms offset dev inode path`
+void pin_add_mapped(pid_t pid) {
+	static char buf[16384];
+	char path[32];
+
+	sformat(path, sizeof(path), "/proc/%d/maps", pid);
+
+	int len = read_file(path, buf, sizeof(buf));
+
+	for (char* line = buf; len > 0 && *line; ) {
+		char* next = line;
+
+		while (*next && *next != '\n')
+			next++;
+
+		if (*next)
+			*next++ = 0;
+
+		// The path is the only field with a slash in it
+		char* file = strchr(line, '/');
+
+		if (file && strncmp(file, "/dev/", 5))
+			pin_add(file);
+
+		line = next;
+	}
+}
+
+// Returns the amount of memory locked, 0 if it didn't work
+long pin_file(char* path) {
+	int fd = open(path, O_RDONLY | O_CLOEXEC, 0);
+
+	// Not every rootfs has everything on the default list
+	// Same for a file that was deleted or replaced since it got mapped
+	if (fd < 0)
+		return 0;
+
+	off_t size = lseek(fd, 0, SEEK_END);
+
+	if (size <= 0) {
+		close(fd);
+		return 0;
+	}
+
+	void* addr = mmap(NULL, size, PROT_READ, MAP_SHARED | MAP_POPULATE, fd, 0);
+
+	// The mapping holds on to the file by itself
+	close(fd);
+
+	if (addr == MAP_FAILED || mlock(addr, size)) {
+		warn("pin: failed to lock [%s] in memory\n", path);
+		return 0;
+	}
+
+	return (size + page_size - 1) / page_size * page_size;
+}
+
+void pin_files() {
+	static char buf[512];
+	char* list = boot_option("mi_pin");
+	char* rescue = boot_option("mi_rescue");
+	long pinned = 0;
+	int count = 0;
+
+	if (!list)
+		list = pin_defaults;
+
+	if (!strcmp(list, "0"))
+		return;
+
+	if (strlen(list) >= sizeof(buf)) {
+		warn("pin: mi_pin= is too long\n");
+		return;
+	}
+
+	strcpy(buf, list);
+
+	for (char* path = buf; *path; ) {
+		char* next = path;
+
+		while (*next && *next != ',')
+			next++;
+
+		if (*next)
+			*next++ = 0;
+
+		pin_add(path);
+
+		path = next;
+	}
+
+	if (rescue)
+		pin_add(rescue);
+
+	for (int i = 0; i < service_count; i++)
+		if (services[i].pid)
+			pin_add_mapped(services[i].pid);
+
+	for (int i = 0; i < pin_count; i++) {
+		long size = pin_file(pin_list[i]);
+
+		if (size)
+			printf("pin: [%s] %ld KB\n", pin_list[i], size / 1024);
+
+		pinned += size;
+		count += size > 0;
+	}
+
+	printf("pin: %d files, %ld KB locked in memory\n", count, pinned / 1024);
+}
+
+
+
+
+//
+// Root shell, the first thing that greets you
+//
+
+// Ubuntu Base does not have any init system as it turns out
+// Just launch bash then
+// (Using `su -`)
+//
+// "can't access tty; job control turned off" workarounds:
+// https://www.linux.org.ru/forum/general/6211553
+// Adding --pty fixed it
+//
+// Once it exits, the system shuts down
+struct service* exec_shell() {
+	char* argv[] = { "su", "-", "--pty", NULL };
+
+	notice("Dropping you into a root shell so you can set a password or create a new account. If done, use Ctrl + Alt + F2 to F12 to switch into a real console.\n");
+
+	struct service* shell = add_service("shell", "/bin/su", argv, RESTART_NEVER, 0);
+
+	start_service(shell);
+
+	if (shell->pid)
+		return shell;
+
+	struct service* sshd = find_service("sshd");
+
+	// Still reachable over ssh, so keep going rather than stop everything
+	if (!sshd || sshd->state != SERVICE_RUNNING)
+		err("exec_shell: failed to start shell\n");
+
+	warn("exec_shell: failed to start shell, staying up for ssh\n");
+
+	return NULL;
+}
+
+
+//
+// Loopback
+//
+
+// include/uapi/linux/sockios.h
+#define SIOCGIFFLAGS 0x8913
+#define SIOCSIFFLAGS 0x8914
+
+// include/uapi/linux/if.h
+#define IFF_UP 1
+
+struct ifreq {
+	char ifr_name[16];
+	union {
+		short ifr_flags;
+		char ifr_pad[24];
+	};
+};
+
+// This is required for nginx or other TCP servers to be reachable via 127.0.0.1
+// Sanity check: `ssh 127.0.0.1` should work
+//
+// Same as `ip link set up dev lo`, minus the fork
+// Any socket will do for interface ioctls
+void activate_loopback() {
+	struct ifreq ifr = { "lo" };
+
+	int fd = socket(AF_INET, SOCK_DGRAM | O_CLOEXEC, 0);
+
+	if (fd < 0) {
+		warn("activate_loopback: failed to create a socket\n");
+		return;
+	}
+
+	int rc = ioctl(fd, SIOCGIFFLAGS, &ifr);
+
+	if (!rc) {
+		ifr.ifr_flags |= IFF_UP;
+		rc = ioctl(fd, SIOCSIFFLAGS, &ifr);
+	}
+
+	if (rc)
+		warn("Failed to bring up [lo]\n");
+
+	close(fd);
+}
+
+
+//
+// Set hostname
+//
+
+// `sudo` is unhappy without a valid hostname set
+// Sanity check: `ssh localhost` should work
+//
+// Same as `hostname -F /etc/hostname`: the first line that isn't a comment, without the whitespace
+void set_hostname() {
+	char buf[256];
+
+	int len = read_file("/etc/hostname", buf, sizeof(buf));
+
+	if (len < 0) {
+		warn("Failed to open [/etc/hostname]\n");
+		return;
+	}
+
+	char* name = buf;
+
+	while (*name) {
+		char* end = strchr(name, '\n');
+
+		if (end)
+			*end = 0;
+
+		while (*name == ' ' || *name == '\t')
+			name++;
+
+		if (*name && *name != '#')
+			break;
+
+		name = end ? end + 1 : name + strlen(name);
+	}
+
+	len = strlen(name);
+
+	while (len && (name[len - 1] == ' ' || name[len - 1] == '\t' || name[len - 1] == '\r'))
+		len--;
+
+	if (!len) {
+		warn("[/etc/hostname] is empty\n");
+		return;
+	}
+
+	int rc = sethostname(name, len);
+
+	if (rc)
+		warn("Failed to set the hostname\n");
+}
+
+
+//
+// Sysctl
+//
+
+// Usually this is done using `sysctl --system`
+// But we can avoid using it, saving us a fork()
+//
+// Applied in this order, later settings win:
+// 1. The defaults below
+// 2. *.conf from the directories below, sorted by file name
+//    A name that appears in several directories is only read from the first one
+// 3. /etc/sysctl.conf
+char* sysctl_defaults[] = {
+	//"net.ipv4.tcp_congestion_control = bbr",	// Switch to a better congestion control algorithm
+	"net.ipv4.ip_forward = 1",			// Allow packets to jump between interfaces
+	NULL
+};
+
+char* sysctl_dirs[] = { "/etc/sysctl.d", "/run/sysctl.d", "/usr/local/lib/sysctl.d", "/usr/lib/sysctl.d", "/lib/sysctl.d", NULL };
+
+#define SYSCTL_MAX_FILES 64
+#define SYSCTL_NAME_MAX 64
+
+struct sysctl_file {
+	char* dir;
+	char name[SYSCTL_NAME_MAX];
+};
+
+struct sysctl_file sysctl_files[SYSCTL_MAX_FILES];
+int sysctl_file_count = 0;
+
+int sysctl_proc_fd = -1;	// /proc/sys, every key is opened relative to it
+int sysctl_applied = 0;
+int sysctl_failed = 0;
+char sysctl_failures[256];	// Keys that failed, for the summary
+int sysctl_failures_len = 0;
+
+void sysctl_failure(char* key) {
+	sysctl_failed++;
+
+	// The count is still right if the names don't fit
+	if (sysctl_failures_len + strlen(key) + 2 > sizeof(sysctl_failures))
+		return;
+
+	if (sysctl_failures_len)
+		sysctl_failures[sysctl_failures_len++] = ' ';
+
+	strcpy(sysctl_failures + sysctl_failures_len, key);
+	sysctl_failures_len += strlen(key);
+}
+
+char* trim(char* str) {
+	while (*str == ' ' || *str == '\t')
+		str++;
+
+	int len = strlen(str);
+
+	while (len && (str[len - 1] == ' ' || str[len - 1] == '\t' || str[len - 1] == '\r'))
+		str[--len] = 0;
+
+	return str;
+}
+
+// `key = value`, `# comment`, `; comment`
+// A leading `-` means failures to set the key are ignored
+void apply_sysctl_line(char* line) {
+	char path[256];
+
+	line = trim(line);
+
+	if (!*line || *line == '#' || *line == ';')
+		return;
+
+	int optional = *line == '-';
+
+	if (optional)
+		line++;
+
+	char* eq = strchr(line, '=');
+
+	if (!eq) {
+		sysctl_failure(line);
+		return;
+	}
+
+	*eq = 0;
+
+	char* key = trim(line);
+	char* value = trim(eq + 1);
+
+	// net.ipv4.ip_forward -> net/ipv4/ip_forward, unless it's already written with slashes
+	int slashes = strchr(key, '/') != NULL;
+	int len = 0;
+
+	for (; key[len] && len < sizeof(path) - 1; len++)
+		path[len] = (key[len] == '.' && !slashes) ? '/' : key[len];
+
+	path[len] = 0;
+
+	int fd = openat(sysctl_proc_fd, path, O_WRONLY | O_CLOEXEC, 0);
+	int rc = -1;
+
+	if (fd >= 0) {
+		rc = write(fd, value, strlen(value));
+		close(fd);
+	}
+
+	if (rc >= 0)
+		sysctl_applied++;
+	else if (!optional)
+		sysctl_failure(key);
+}
+
+void apply_sysctl_file(char* path) {
+	static char buf[16384];
+
+	if (read_file(path, buf, sizeof(buf)) < 0)
+		return;
+
+	char* line = buf;
+
+	while (line) {
+		char* end = strchr(line, '\n');
+
+		if (end)
+			*end++ = 0;
+
+		apply_sysctl_line(line);
+		line = end;
+	}
+}
+
+// Collect *.conf from one directory, skipping names that are already taken
+void find_sysctl_files(char* dir) {
+	static char buf[4096];
+
+	int fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC, 0);
+
+	if (fd < 0)
+		return;
+
+	int len;
+
+	while ((len = getdents64(fd, (void*)buf, sizeof(buf))) > 0) {
+		for (int pos = 0; pos < len; pos += ((struct linux_dirent64*)(buf + pos))->d_reclen) {
+			char* name = ((struct linux_dirent64*)(buf + pos))->d_name;
+			int name_len = strlen(name);
+
+			if (name_len < 6 || name_len >= SYSCTL_NAME_MAX || strcmp(name + name_len - 5, ".conf"))
+				continue;
+
+			int taken = 0;
+
+			for (int i = 0; i < sysctl_file_count; i++)
+				if (!strcmp(sysctl_files[i].name, name))
+					taken = 1;
+
+			if (taken)
+				continue;
+
+			if (sysctl_file_count == SYSCTL_MAX_FILES) {
+				warn("sysctl: too many files, some were skipped\n");
+				break;
+			}
+
+			sysctl_files[sysctl_file_count].dir = dir;
+			strcpy(sysctl_files[sysctl_file_count].name, name);
+			sysctl_file_count++;
+		}
+	}
+
+	close(fd);
+}
+
+void apply_sysctl() {
+	char line[256];
+	char path[256];
+
+	sysctl_proc_fd = open("/proc/sys", O_RDONLY | O_DIRECTORY | O_CLOEXEC, 0);
+
+	if (sysctl_proc_fd < 0) {
+		warn("sysctl: failed to open [/proc/sys]\n");
+		return;
+	}
+
+	// The parser works in place and string literals are read-only
+	for (int i = 0; sysctl_defaults[i]; i++)
+		apply_sysctl_line(strcpy(line, sysctl_defaults[i]));
+
+	for (int i = 0; sysctl_dirs[i]; i++)
+		find_sysctl_files(sysctl_dirs[i]);
+
+	// Insertion sort by file name, there are only a few
+	for (int i = 1; i < sysctl_file_count; i++) {
+		struct sysctl_file file = sysctl_files[i];
+		int j = i;
+
+		for (; j > 0 && strcmp(sysctl_files[j - 1].name, file.name) > 0; j--)
+			sysctl_files[j] = sysctl_files[j - 1];
+
+		sysctl_files[j] = file;
+	}
+
+	for (int i = 0; i < sysctl_file_count; i++) {
+		strcpy(path, sysctl_files[i].dir);
+		strcpy(path + strlen(path), "/");
+		strcpy(path + strlen(path), sysctl_files[i].name);
+
+		apply_sysctl_file(path);
+	}
+
+	apply_sysctl_file("/etc/sysctl.conf");
+
+	close(sysctl_proc_fd);
+
+	if (!sysctl_failed)
+		return;
+
+	warn("sysctl: %d failed, %d applied; failed: %s\n", sysctl_failed, sysctl_applied, sysctl_failures);
+}
+
+
+//
+// Ctrl + Alt + F2 to F12 terminals
+//
+
+// Everything a console needs lives here for as long as init runs
+// Respawning after a logout reuses the same entry and the same service slot
+struct tty {
+	char* name;
+	struct service* service;
+};
+
+struct tty ttys[] = {
+	{ "tty2" }, { "tty3" }, { "tty4" }, { "tty5" }, { "tty6" }, { "tty7" },
+	{ "tty8" }, { "tty9" }, { "tty10" }, { "tty11" }, { "tty12" },
+};
+
+#define TTY_COUNT (sizeof(ttys) / sizeof(ttys[0]))
+
+// Restarted by the supervisor after every logout
+void add_agetty(struct tty* tty) {
+	char* argv[] = { "agetty", tty->name, NULL };
+
+	tty->service = add_service(tty->name, "/sbin/agetty", argv, RESTART_SESSION, SPAWN_SETSID);
+}
+
+void exec_agetty(struct tty* tty) {
+	if (!tty->service)
+		add_agetty(tty);
+
+	start_service(tty->service);
+}
+
+// On a headless box nobody ever switches to tty2..tty12
+// With `mi_lazy_tty=1` a getty is only started the first time its console is switched to
+// The kernel wakes up pollers of /sys/class/tty/tty0/active on every switch
+int active_vt_fd = -1;
+
+void start_active_tty() {
+	char name[16];
+
+	lseek(active_vt_fd, 0, SEEK_SET);
+
+	int len = read(active_vt_fd, name, sizeof(name) - 1);
+
+	if (len <= 0)
+		return;
+
+	name[len] = 0;
+
+	char* newline = strchr(name, '\n');
+
+	if (newline)
+		*newline = 0;
+
+	for (int i = 0; i < TTY_COUNT; i++)
+		if (!strcmp(ttys[i].name, name) && ttys[i].service->state == SERVICE_IDLE)
+			start_service(ttys[i].service);
+}
+
+void start_every_tty() {
+	if (boot_option_int("mi_lazy_tty", 0)) {
+		active_vt_fd = open("/sys/class/tty/tty0/active", O_RDONLY | O_CLOEXEC, 0);
+
+		if (active_vt_fd < 0)
+			warn("Failed to open [/sys/class/tty/tty0/active], starting every tty\n");
+	}
+
+	if (active_vt_fd < 0) {
+		for (int i = 0; i < TTY_COUNT; i++)
+			exec_agetty(&ttys[i]);
+
+		return;
+	}
+
+	for (int i = 0; i < TTY_COUNT; i++) {
+		add_agetty(&ttys[i]);
+		ttys[i].service->state = SERVICE_IDLE;
+	}
+
+	write_service_status();
+
+	// sysfs signals a change with POLLPRI | POLLERR
+	watch_fd(active_vt_fd, POLLPRI, start_active_tty);
+
+	// Someone may have switched already
+	start_active_tty();
+}
+
+
+//
+// SSH server
+//
+
+// Ensure we have host keys
+pid_t exec_ssh_keygen() {
+	char* argv[] = { "ssh-keygen", "-A", NULL };
+	char* envp[] = { "HOME=/", "TERM=linux", NULL };
+
+	return spawn("/bin/ssh-keygen", argv, envp, SPAWN_NULL_STDIN, NULL);
+}
+
+// Do not keep restarting it if it keeps exiting with an error
+void start_ssh() {
+	char* argv[] = { "/sbin/sshd", "-D", NULL };
+
+	// The "privilege separation directory"
+	int rc = mkdir("/run/sshd", 0755);
+
+	if (rc)
+		warn("Failed to create [/run/sshd]\n");
+
+	start_service(add_service("sshd", "/sbin/sshd", argv, RESTART_ON_SUCCESS, 0));
+}
+
+
+//
+// Boot scheduler
+//
+
+// Every step of the startup sequence
+// Steps that don't depend on each other run at the same time
+enum {
+	UNIT_MOUNTS,
+	UNIT_READAHEAD,
+	UNIT_CONTROL,
+	UNIT_ZRAM_SWAP,
+	UNIT_ZRAM_MKFS,
+	UNIT_ZRAM_VAR_LOG,
+	UNIT_DEV_LINKS,
+	UNIT_LOOPBACK,
+	UNIT_HOSTNAME,
+	UNIT_SYSCTL,
+	UNIT_TTYS,
+	UNIT_SSH_KEYGEN,
+	UNIT_SSH,
+	UNIT_PIN,
+	UNIT_COUNT
+};
+
+#define AFTER(unit) (1 << (unit))
+
+#define UNIT_PENDING 0
+#define UNIT_RUNNING 1
+#define UNIT_DONE 2
+
+struct unit {
+	char* name;
+	int after;		// Units that have to finish first
+	void (*run)();		// Either runs inside init...
+	pid_t (*spawn)();	// ...or starts a process and is done when it exits
+	pid_t pid;
+	int state;
+	int event;		// Boot timeline entry
+};
+
+// Only declare what a step actually needs
+// i.e. `agetty` prints the hostname and writes to /run/utmp and /var/log/wtmp
+struct unit units[UNIT_COUNT] = {
+	[UNIT_MOUNTS]		= { "mounts",		0,						mount_filesystems },
+	[UNIT_READAHEAD]	= { "readahead",	AFTER(UNIT_MOUNTS),				start_readahead },
+	[UNIT_CONTROL]		= { "control",		AFTER(UNIT_MOUNTS),				start_control },
+	[UNIT_ZRAM_SWAP]	= { "zram_swap",	AFTER(UNIT_MOUNTS),				setup_zram_swap },
+	[UNIT_ZRAM_MKFS]	= { "zram_mkfs",	AFTER(UNIT_MOUNTS),				NULL, exec_zram_mkfs },
+	[UNIT_ZRAM_VAR_LOG]	= { "zram_var_log",	AFTER(UNIT_ZRAM_MKFS),				mount_zram_var_log },
+	[UNIT_DEV_LINKS]	= { "dev_links",	AFTER(UNIT_MOUNTS),				symlink_dev },
+	[UNIT_LOOPBACK]		= { "loopback",		0,						activate_loopback },
+	[UNIT_HOSTNAME]		= { "hostname",		0,						set_hostname },
+	[UNIT_SYSCTL]		= { "sysctl",		AFTER(UNIT_MOUNTS),				apply_sysctl },
+	[UNIT_TTYS]		= { "ttys",		AFTER(UNIT_MOUNTS) | AFTER(UNIT_ZRAM_VAR_LOG) |
+						AFTER(UNIT_HOSTNAME),				start_every_tty },
+	[UNIT_SSH_KEYGEN]	= { "ssh_keygen",	AFTER(UNIT_MOUNTS),				NULL, exec_ssh_keygen },
+	[UNIT_SSH]		= { "ssh",		AFTER(UNIT_MOUNTS) | AFTER(UNIT_SSH_KEYGEN) |
+						AFTER(UNIT_LOOPBACK) | AFTER(UNIT_HOSTNAME),	start_ssh },
+	[UNIT_PIN]		= { "pin",		AFTER(UNIT_TTYS) | AFTER(UNIT_SSH),		pin_files },
+};
+
+// Bitmask of units that have finished
+int units_done() {
+	int done = 0;
+
+	for (int i = 0; i < UNIT_COUNT; i++)
+		if (units[i].state == UNIT_DONE)
+			done |= AFTER(i);
+
+	return done;
+}
+
+// Start everything that is ready to go
+// Steps that run inside init finish right away and may unblock more steps, hence the outer loop
+// Processes go first in every pass, so that they run alongside the steps that keep init busy
+void start_ready_units() {
+	int done = units_done();
+	int progress = 1;
+
+	while (progress) {
+		progress = 0;
+
+		for (int n = 0; n < 2 * UNIT_COUNT; n++) {
+			int i = n % UNIT_COUNT;
+			struct unit* unit = &units[i];
+
+			if (unit->state != UNIT_PENDING)
+				continue;
+
+			if ((unit->after & done) != unit->after)
+				continue;
+
+			// Processes in the first round, in-process steps in the second
+			if (!unit->run != (n < UNIT_COUNT))
+				continue;
+
+			unit->event = timeline_begin(unit->name);
+
+			if (unit->run) {
+				unit->run();
+				timeline_end(unit->event);
+				unit->state = UNIT_DONE;
+				done |= AFTER(i);
+				progress = 1;
+
+				// Whatever it unblocked may be a process
+				break;
+			}
+
+			unit->pid = unit->spawn();
+
+			// Failed to start; carry on without it, just like a failed exit
+			if (unit->pid < 0) {
+				timeline_end(unit->event);
+				unit->state = UNIT_DONE;
+				done |= AFTER(i);
+				progress = 1;
+				continue;
+			}
+
+			unit->state = UNIT_RUNNING;
+		}
+	}
+}
+
+// Called by the supervisor for every child that exits
+// Returns 0 if the pid doesn't belong to any unit
+int unit_exited(pid_t pid, int exitcode) {
+	for (int i = 0; i < UNIT_COUNT; i++) {
+		struct unit* unit = &units[i];
+
+		if (unit->state != UNIT_RUNNING || unit->pid != pid)
+			continue;
+
+		if WEXITSTATUS(exitcode)
+			warn("[%s] Exited with an error\n", unit->name);
+
+		timeline_end(unit->event);
+		unit->state = UNIT_DONE;
+
+		return 1;
+	}
+
+	return 0;
+}
+
+// Run every unit, starting new ones as the spawned ones finish
+// Services started along the way are already being supervised
+void boot() {
+	int event = timeline_begin("boot");
+
+	while (1) {
+		start_ready_units();
+
+		int running = 0;
+
+		for (int i = 0; i < UNIT_COUNT; i++)
+			if (units[i].state == UNIT_RUNNING)
+				running++;
+
+		// Units that are still running get terminated along with everything else
+		if (!running || shutdown_cmd)
+			break;
+
+		wait_for_events(-1);
+	}
+
+	timeline_end(event);
+}
+
+
+//
+// Emergency
+//
+
+// Where err() ends up
+// Parks PID 1 in ppoll() instead of spinning, so a failed boot doesn't keep a core busy forever
+// Services that are already up stay supervised instead, so that i.e. sshd can still be used to fix things
+//
+// `mi_rescue=/bin/sh` starts that shell on the console first
+// `mi_panic=N` reboots N seconds later (after the rescue shell exits, if there is one)
+void emergency() {
+	int timeout = boot_option_int("mi_panic", 0);
+	char* rescue = boot_option("mi_rescue");
+
+	// Not once they are being shut down
+	int supervise = service_count > 0 && !shutdown_cmd;
+
+	if (rescue) {
+		char* argv[] = { rescue, NULL };
+		int status = 0;
+
+		warn("Starting a rescue shell [%s]\n", rescue);
+
+		// Keep restarting the services while it runs
+		if (supervise && service_count < MAX_SERVICES) {
+			struct service* shell = add_service("rescue", rescue, argv, RESTART_NEVER, 0);
+
+			start_service(shell);
+
+			while (shell->pid)
+				wait_for_events(-1);
+
+			rescue = NULL;
+		}
+
+		pid_t pid = rescue ? spawn(rescue, argv, service_envp, 0, NULL) : -1;
+
+		// Reap whatever else exits in the meantime
+		while (pid > 0) {
+			pid_t exited = waitpid(-1, &status, 0);
+
+			if (exited == pid || exited < 0)
+				break;
+		}
+	}
+
+	if (timeout > 0) {
+		warn("Rebooting in %d seconds...\n", timeout);
+
+		poll(NULL, 0, timeout * 1000);
+
+		sync();
+		reboot(LINUX_REBOOT_CMD_RESTART);
+	}
+
+	if (supervise) {
+		printf("Stopping, services are still supervised...\n");
+
+		while (!shutdown_cmd)
+			wait_for_events(-1);
+
+		shut_down(shutdown_cmd);
+	}
+
+	printf("Stopping...\n");
+
+	while (1) {
+		poll(NULL, 0, -1);
+	}
+}
+
+//
+// Shutdown sequence
+//
+
+// include/uapi/linux/mount.h
+#define MS_REMOUNT 32
+
+// SIGTERM everyone at once and reap them as they exit
+// Whoever is still around when the time is up gets SIGKILL, and the same amount of time to go away
+// Reaps here instead of in the supervisor, so that nothing gets restarted
+void terminate_processes() {
+	int timeout = stop_timeout;
+	int64_t deadline = now_ms() + timeout;
+	int signal = SIGTERM;
+
+	printf("Terminating processes...\n");
+
+	kill(-1, SIGTERM);
+
+	while (1) {
+		struct signalfd_siginfo info[4];
+		struct pollfd fds[1] = { { signal_fd, POLLIN, 0 } };
+		pid_t pid;
+
+		while (read(signal_fd, info, sizeof(info)) > 0) {
+		}
+
+		while ((pid = waitpid(-1, NULL, WNOHANG)) > 0) {
+		}
+
+		// ECHILD, there is nobody left
+		if (pid < 0)
+			return;
+
+		int left = deadline - now_ms();
+
+		if (left > 0) {
+			poll(fds, 1, left);
+			continue;
+		}
+
+		// Stuck in the kernel, most likely
+		if (signal == SIGKILL) {
+			warn("Some processes refuse to die, going on without them\n");
+			return;
+		}
+
+		warn("Some processes ignored SIGTERM, killing them\n");
+
+		signal = SIGKILL;
+		deadline = now_ms() + timeout;
+
+		kill(-1, SIGKILL);
+	}
+}
+
+// /proc/mounts spells spaces and such in octal, i.e. `\040`
+void unescape(char* str) {
+	char* out = str;
+
+	while (*str) {
+		if (str[0] == '\\' && str[1] && str[2] && str[3]) {
+			*out++ = (str[1] - '0') * 64 + (str[2] - '0') * 8 + (str[3] - '0');
+			str += 4;
+		} else {
+			*out++ = *str++;
+		}
+	}
+
+	*out = 0;
+}
+
+// Unmounting would fail on anything still in use, while a read-only remount is enough to leave the filesystems clean
+// Goes from the last mount back, so that filesystems on loop devices are done before the ones holding their images
+// Only complains about filesystems that are backed by a device
+void remount_readonly() {
+	static char buf[16384];
+
+	printf("Remounting filesystems read-only...\n");
+
+	int len = read_file("/proc/self/mounts", buf, sizeof(buf));
+
+	if (len < 0) {
+		warn("Failed to read /proc/self/mounts\n");
+		return;
+	}
+
+	for (int i = 0; i < len; i++)
+		if (buf[i] == '\n')
+			buf[i] = 0;
+
+	// `end` is always on the terminator of a line
+	for (int end = len - 1; end > 0; ) {
+		int start = end;
+
+		while (start > 0 && buf[start - 1])
+			start--;
+
+		// Source, target, type, options
+		char* fields[4] = { 0 };
+		char* pos = buf + start;
+
+		for (int i = 0; i < 4 && *pos; i++) {
+			fields[i] = pos;
+
+			while (*pos && *pos != ' ')
+				pos++;
+
+			if (*pos)
+				*pos++ = 0;
+		}
+
+		end = start - 1;
+
+		if (!fields[3] || !strncmp(fields[3], "ro", 2))
+			continue;
+
+		unescape(fields[1]);
+
+		int rc = mount(NULL, fields[1], NULL, MS_REMOUNT | MS_RDONLY, NULL);
+
+		if (rc && fields[0][0] == '/')
+			warn("Failed to remount [%s] read-only\n", fields[1]);
+	}
+}
+
+// Loop devices can outlive their filesystems, i.e. the ones that were lazily unmounted during the switch
+// LOOP_CLR_FD detaches those, and only marks the ones still in use for autoclear
+void detach_loops() {
+	char buf[1024];
+	int len;
+
+	int fd = open("/sys/block", O_RDONLY | O_DIRECTORY | O_CLOEXEC, 0);
+
+	if (fd < 0)
+		return;
+
+	while ((len = getdents64(fd, (void*)buf, sizeof(buf))) > 0) {
+		for (int pos = 0; pos < len; pos += ((struct linux_dirent64*)(buf + pos))->d_reclen) {
+			char* name = ((struct linux_dirent64*)(buf + pos))->d_name;
+			char path[32];
+
+			if (strncmp(name, "loop", 4))
+				continue;
+
+			sformat(path, sizeof(path), "/dev/%s", name);
+
+			int loop_fd = open(path, O_RDONLY | O_CLOEXEC, 0);
+
+			if (loop_fd < 0)
+				continue;
+
+			ioctl(loop_fd, LOOP_CLR_FD, 0);
+			close(loop_fd);
+		}
+	}
+
+	close(fd);
+}
+
+// `mi_kexec=1` restarts straight into a kernel instead of going through the firmware
+// That is the running one, /boot/vmlinuz-<release>, unless `mi_kexec_kernel=` points somewhere else
+// `mi_kexec_initrd=` passes it an initramfs; the command line stays the same
+// Returns 1 if the kernel got loaded and LINUX_REBOOT_CMD_KEXEC can be used
+int kexec_prepare() {
+	static char cmdline[4096];
+	char path[128];
+	struct utsname uts = { 0 };
+	char* kernel = boot_option("mi_kexec_kernel");
+	char* initrd = boot_option("mi_kexec_initrd");
+	int flags = initrd ? 0 : KEXEC_FILE_NO_INITRAMFS;
+	int initrd_fd = -1;
+	int rc = -1;
+
+	if (!boot_option_int("mi_kexec", 0))
+		return 0;
+
+	if (!kernel) {
+		uname(&uts);
+		sformat(path, sizeof(path), "/boot/vmlinuz-%s", uts.release);
+		kernel = path;
+	}
+
+	int len = read_file("/proc/cmdline", cmdline, sizeof(cmdline));
+
+	if (len < 0)
+		len = 0;
+
+	if (len > 0 && cmdline[len - 1] == '\n')
+		len--;
+
+	cmdline[len] = 0;
+
+	int kernel_fd = open(kernel, O_RDONLY | O_CLOEXEC, 0);
+
+	if (initrd)
+		initrd_fd = open(initrd, O_RDONLY | O_CLOEXEC, 0);
+
+	// The length includes the terminator
+	if (kernel_fd >= 0 && (!initrd || initrd_fd >= 0))
+		rc = kexec_file_load(kernel_fd, initrd_fd, len + 1, cmdline, flags);
+
+	if (kernel_fd >= 0)
+		close(kernel_fd);
+
+	if (initrd_fd >= 0)
+		close(initrd_fd);
+
+	if (rc) {
+		warn("kexec: failed to load [%s], rebooting through the firmware\n", kernel);
+		return 0;
+	}
+
+	printf("kexec: loaded [%s]\n", kernel);
+
+	return 1;
+}
+
+// cmd is one of LINUX_REBOOT_CMD_*
+void shut_down(int cmd) {
+	int64_t start = now_ms();
+
+	// Before anything is stopped, so that a kernel that won't load is known early
+	if (cmd == LINUX_REBOOT_CMD_RESTART && kexec_prepare())
+		cmd = LINUX_REBOOT_CMD_KEXEC;
+
+	terminate_processes();
+
+	printf("Syncing...\n");
+	sync();
+
+	remount_readonly();
+	detach_loops();
+
+	printf("Shutdown took %d ms\n", (int)(now_ms() - start));
+
+	reboot(cmd);
+
+	// Not in a PID namespace
+	if (cmd == LINUX_REBOOT_CMD_KEXEC)
+		reboot(LINUX_REBOOT_CMD_RESTART);
+
+	// Only without CAP_SYS_BOOT
+	err("Failed to reboot\n");
+}
+
+
+//
+// Startup sequence
+//
+
+int main(int argc, char* argv[], char* envp[]) {
+	char* name = strrchr(argv[0], '/');
+
+	name = name ? name + 1 : argv[0];
+
+	// The client for the control socket
+	if (!strcmp(name, "micro_ctl"))
+		return control_client(argc, argv);
+
+	// Reads files ahead during boot, see start_readahead()
+	if (!strcmp(name, "micro_readahead"))
+		return readahead_replay();
+
+	int event = timeline_begin("init");
+
+	mount_devtmpfs();
+
+	printf("= = = Micro Init = = =\n");
+
+	boot_env = envp;
+
+	// The auxiliary vector comes right after the environment
+	char** env = envp;
+
+	while (*env)
+		env++;
+
+	for (long* aux = (long*)(env + 1); aux[0]; aux += 2)
+		if (aux[0] == AT_PAGESZ)
+			page_size = aux[1];
+
+	if (boot_option_int("mi_kmsg", 0))
+		kmsg_fd = open("/dev/kmsg", O_WRONLY | O_CLOEXEC, 0);
+
+	read_restart_options();
+
+	// PID 1 and everything it starts will end up in the new root
+	//boot_from_image(argv, envp);
+
+	// Must come before anything gets started
+	watch_children();
+
+	// Mounts, oneshot operations and restart-capable stuff
+	// See the unit table for the order
+	boot();
+
+	// Transfer over to bash
+	// Unless a shutdown was asked for during boot, it would only get killed right away
+	struct service* shell = shutdown_cmd ? NULL : exec_shell();
+
+	timeline_end(event);
+	write_timeline();
+	readahead_save();
+
+	// Keep the services running for as long as the shell lives, for good if it never started
+	// Or until something asks for a shutdown
+	while ((!shell || shell->pid) && !shutdown_cmd) {
+		wait_for_events(-1);
+	}
+
+	if (!shutdown_cmd) {
+		printf("Initial shell exited, entering shutdown sequence\n");
+		shutdown_cmd = LINUX_REBOOT_CMD_RESTART;
 	}
 
+	shut_down(shutdown_cmd);
 
 	return 0;
 }
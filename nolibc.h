@@ -84,9 +84,13 @@
 #include <asm/unistd.h>
 #include <asm/ioctls.h>
 #include <asm/errno.h>
+#include <asm/statfs.h>
+#include <linux/fanotify.h>
 #include <linux/fs.h>
 #include <linux/loop.h>
+#include <linux/sched.h>
 #include <linux/time.h>
+#include <linux/un.h>
 
 #define NOLIBC
 
@@ -145,6 +149,44 @@ struct pollfd {
 	short int revents;
 };
 
+#define POLLIN          0x0001
+#define POLLPRI         0x0002
+#define POLLOUT         0x0004
+#define POLLERR         0x0008
+#define POLLHUP         0x0010
+#define POLLNVAL        0x0020
+
+/* for mmap() */
+#define PROT_READ       0x1
+#define MAP_SHARED      0x01
+#if defined(__mips__)
+#define MAP_POPULATE    0x10000
+#else
+#define MAP_POPULATE    0x8000
+#endif
+#define MAP_FAILED      ((void *)-1)
+
+/* for kexec_file_load() */
+#define KEXEC_FILE_UNLOAD       0x00000001
+#define KEXEC_FILE_ON_CRASH     0x00000002
+#define KEXEC_FILE_NO_INITRAMFS 0x00000004
+
+/* for uname() */
+struct utsname {
+	char sysname[65];
+	char nodename[65];
+	char release[65];
+	char version[65];
+	char machine[65];
+	char domainname[65];
+};
+
+/* for writev() */
+struct iovec {
+	void  *iov_base;
+	size_t iov_len;
+};
+
 /* for getdents64() */
 struct linux_dirent64 {
 	uint64_t       d_ino;
@@ -210,18 +252,53 @@ struct rusage {
 #define AT_FDCWD             -100
 #endif
 
+#ifndef AT_REMOVEDIR
+#define AT_REMOVEDIR        0x200
+#endif
+
 /* lseek */
 #define SEEK_SET        0
 #define SEEK_CUR        1
 #define SEEK_END        2
 
+/* socket */
+#define AF_UNIX         1
+#define AF_INET         2
+#define AF_NETLINK      16
+
+#if defined(__mips__)
+#define SOCK_DGRAM      1
+#define SOCK_STREAM     2
+#else
+#define SOCK_STREAM     1
+#define SOCK_DGRAM      2
+#endif
+#define SOCK_SEQPACKET  5
+
+#define MSG_DONTWAIT    0x40
+
+typedef unsigned int socklen_t;
+
+/* for sendmsg() and recvmsg() */
+struct msghdr {
+	void         *msg_name;
+	int           msg_namelen;
+	struct iovec *msg_iov;
+	size_t        msg_iovlen;
+	void         *msg_control;
+	size_t        msg_controllen;
+	unsigned int  msg_flags;
+};
+
 /* reboot */
 #define LINUX_REBOOT_MAGIC1         0xfee1dead
 #define LINUX_REBOOT_MAGIC2         0x28121969
+#define LINUX_REBOOT_CMD_CAD_OFF    0x00000000
 #define LINUX_REBOOT_CMD_HALT       0xcdef0123
 #define LINUX_REBOOT_CMD_POWER_OFF  0x4321fedc
 #define LINUX_REBOOT_CMD_RESTART    0x01234567
 #define LINUX_REBOOT_CMD_SW_SUSPEND 0xd000fce2
+#define LINUX_REBOOT_CMD_KEXEC      0x45584543
 
 
 /* The format of the struct as returned by the libc to the application, which
@@ -245,10 +322,50 @@ struct stat {
 
 #define WEXITSTATUS(status)   (((status) & 0xff00) >> 8)
 #define WIFEXITED(status)     (((status) & 0x7f) == 0)
+#define WTERMSIG(status)      ((status) & 0x7f)
+#define WIFSIGNALED(status)   ((status) - 1 < 0xff)
+
+/* for waitpid() */
+#define WNOHANG               1
 
 /* for SIGCHLD */
 #include <asm/signal.h>
 
+/* for rt_sigprocmask() and signalfd4(). The sigset_t from asm/signal.h is the
+ * old one and is too short on some archs, so use the kernel's own layout.
+ */
+#if defined(__mips__)
+#define NOLIBC_NSIG 128
+#else
+#define NOLIBC_NSIG 64
+#endif
+
+typedef struct {
+	unsigned long sig[NOLIBC_NSIG / (8 * sizeof(long))];
+} ksigset_t;
+
+/* what read() returns from a signalfd, 128 bytes */
+struct signalfd_siginfo {
+	uint32_t ssi_signo;
+	int32_t  ssi_errno;
+	int32_t  ssi_code;
+	uint32_t ssi_pid;
+	uint32_t ssi_uid;
+	int32_t  ssi_fd;
+	uint32_t ssi_tid;
+	uint32_t ssi_band;
+	uint32_t ssi_overrun;
+	uint32_t ssi_trapno;
+	int32_t  ssi_status;
+	int32_t  ssi_int;
+	uint64_t ssi_ptr;
+	uint64_t ssi_utime;
+	uint64_t ssi_stime;
+	uint64_t ssi_addr;
+	uint16_t ssi_addr_lsb;
+	uint8_t  __pad[46];
+};
+
 /* Below comes the architecture-specific code. For each architecture, we have
  * the syscall declarations and the _start code definition. This is the only
  * global part. On all architectures the kernel puts everything in the stack
@@ -425,6 +542,8 @@ asm(".section .text\n"
 #define O_APPEND        0x400
 #define O_NONBLOCK      0x800
 #define O_DIRECTORY   0x10000
+#define O_CLOEXEC     0x80000
+#define O_DIRECT       0x4000
 
 /* The struct returned by the stat() syscall, equivalent to stat64(). The
  * syscall returns 116 bytes and stops in the middle of __unused.
@@ -605,6 +724,8 @@ asm(".section .text\n"
 #define O_APPEND        0x400
 #define O_NONBLOCK      0x800
 #define O_DIRECTORY   0x10000
+#define O_CLOEXEC     0x80000
+#define O_DIRECT       0x4000
 
 /* The struct returned by the stat() syscall, 32-bit only, the syscall returns
  * exactly 56 bytes (stops before the unused array).
@@ -790,6 +911,8 @@ asm(".section .text\n"
 #define O_APPEND        0x400
 #define O_NONBLOCK      0x800
 #define O_DIRECTORY    0x4000
+#define O_CLOEXEC     0x80000
+#define O_DIRECT      0x10000
 
 /* The struct returned by the stat() syscall, 32-bit only, the syscall returns
  * exactly 56 bytes (stops before the unused array). In big endian, the format
@@ -987,6 +1110,8 @@ asm(".section .text\n"
 #define O_APPEND        0x400
 #define O_NONBLOCK      0x800
 #define O_DIRECTORY    0x4000
+#define O_CLOEXEC     0x80000
+#define O_DIRECT      0x10000
 
 /* The struct returned by the newfstatat() syscall. Differs slightly from the
  * x86_64's stat one by field ordering, so be careful.
@@ -1193,6 +1318,8 @@ asm(".section .text\n"
 #define O_EXCL         0x0400
 #define O_NOCTTY       0x0800
 #define O_DIRECTORY   0x10000
+#define O_CLOEXEC     0x80000
+#define O_DIRECT       0x8000
 
 /* The struct returned by the stat() syscall. 88 bytes are returned by the
  * syscall.
@@ -1390,6 +1517,8 @@ asm(".section .text\n"
 #define O_APPEND       0x2000
 #define O_NONBLOCK     0x4000
 #define O_DIRECTORY  0x200000
+#define O_CLOEXEC     0x80000
+#define O_DIRECT       0x4000
 
 struct sys_stat_struct {
 	unsigned long	st_dev;		/* Device.  */
@@ -1471,6 +1600,26 @@ int sys_chroot(const char *path)
 	return my_syscall1(__NR_chroot, path);
 }
 
+/* The child shares the memory and the stack of the caller until it calls
+ * execve() or exits, while the caller sleeps. This is forced inline so that
+ * the child doesn't return through a stack frame that the caller still needs;
+ * the child must not return from the calling function either. Same goes for
+ * sys_vfork() below.
+ */
+#ifdef __NR_clone3
+static inline __attribute__((always_inline,unused))
+pid_t sys_clone3(struct clone_args *args, size_t size)
+{
+	return my_syscall2(__NR_clone3, args, size);
+}
+#endif
+
+static __attribute__((unused))
+int sys_clock_gettime(int clock, struct timespec *ts)
+{
+	return my_syscall2(__NR_clock_gettime, clock, ts);
+}
+
 static __attribute__((unused))
 int sys_close(int fd)
 {
@@ -1509,6 +1658,27 @@ int sys_execve(const char *filename, char *const argv[], char *const envp[])
 	return my_syscall3(__NR_execve, filename, argv, envp);
 }
 
+static __attribute__((unused))
+int sys_fanotify_init(unsigned int flags, unsigned int event_flags)
+{
+	return my_syscall2(__NR_fanotify_init, flags, event_flags);
+}
+
+/* The 64-bit mask is split over two registers on 32-bit architectures */
+static __attribute__((unused))
+int sys_fanotify_mark(int fd, unsigned int flags, uint64_t mask, int dirfd, const char *path)
+{
+#if __SIZEOF_LONG__ == 8
+	return my_syscall5(__NR_fanotify_mark, fd, flags, mask, dirfd, path);
+#elif !defined(my_syscall6)
+	return -ENOSYS;
+#elif __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	return my_syscall6(__NR_fanotify_mark, fd, flags, (long)(mask >> 32), (long)mask, dirfd, path);
+#else
+	return my_syscall6(__NR_fanotify_mark, fd, flags, (long)mask, (long)(mask >> 32), dirfd, path);
+#endif
+}
+
 static __attribute__((unused))
 pid_t sys_fork(void)
 {
@@ -1531,6 +1701,36 @@ int sys_fsync(int fd)
 	return my_syscall1(__NR_fsync, fd);
 }
 
+static __attribute__((unused))
+int sys_fsconfig(int fd, unsigned int cmd, const char *key, const void *value, int aux)
+{
+#ifdef __NR_fsconfig
+	return my_syscall5(__NR_fsconfig, fd, cmd, key, value, aux);
+#else
+	return -ENOSYS;
+#endif
+}
+
+static __attribute__((unused))
+int sys_fsmount(int fd, unsigned int flags, unsigned int attr_flags)
+{
+#ifdef __NR_fsmount
+	return my_syscall3(__NR_fsmount, fd, flags, attr_flags);
+#else
+	return -ENOSYS;
+#endif
+}
+
+static __attribute__((unused))
+int sys_fsopen(const char *fstype, unsigned int flags)
+{
+#ifdef __NR_fsopen
+	return my_syscall2(__NR_fsopen, fstype, flags);
+#else
+	return -ENOSYS;
+#endif
+}
+
 static __attribute__((unused))
 int sys_getdents64(int fd, struct linux_dirent64 *dirp, int count)
 {
@@ -1567,6 +1767,17 @@ int sys_ioctl(int fd, unsigned long req, void *value)
 	return my_syscall3(__NR_ioctl, fd, req, value);
 }
 
+/* Only some archs have it: x86_64, arm64, s390, ppc64, riscv */
+static __attribute__((unused))
+int sys_kexec_file_load(int kernel_fd, int initrd_fd, unsigned long cmdline_len, const char *cmdline, unsigned long flags)
+{
+#ifdef __NR_kexec_file_load
+	return my_syscall5(__NR_kexec_file_load, kernel_fd, initrd_fd, cmdline_len, cmdline, flags);
+#else
+	return -ENOSYS;
+#endif
+}
+
 static __attribute__((unused))
 int sys_kill(pid_t pid, int signal)
 {
@@ -1603,6 +1814,25 @@ int sys_mkdir(const char *path, mode_t mode)
 #endif
 }
 
+static __attribute__((unused))
+int sys_mlock(const void *addr, size_t len)
+{
+	return my_syscall2(__NR_mlock, addr, len);
+}
+
+/* mmap2() takes the offset in 4096 byte units */
+static __attribute__((unused))
+void *sys_mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset)
+{
+#if !defined(my_syscall6)
+	return (void *)-ENOSYS;
+#elif defined(__NR_mmap2)
+	return (void *)my_syscall6(__NR_mmap2, addr, length, prot, flags, fd, offset >> 12);
+#else
+	return (void *)my_syscall6(__NR_mmap, addr, length, prot, flags, fd, offset);
+#endif
+}
+
 static __attribute__((unused))
 long sys_mknod(const char *path, mode_t mode, dev_t dev)
 {
@@ -1622,6 +1852,16 @@ int sys_mount(const char *src, const char *tgt, const char *fst,
 	return my_syscall5(__NR_mount, src, tgt, fst, flags, data);
 }
 
+static __attribute__((unused))
+int sys_move_mount(int from_dfd, const char *from_path, int to_dfd, const char *to_path, unsigned int flags)
+{
+#ifdef __NR_move_mount
+	return my_syscall5(__NR_move_mount, from_dfd, from_path, to_dfd, to_path, flags);
+#else
+	return -ENOSYS;
+#endif
+}
+
 static __attribute__((unused))
 int sys_open(const char *path, int flags, mode_t mode)
 {
@@ -1634,6 +1874,12 @@ int sys_open(const char *path, int flags, mode_t mode)
 #endif
 }
 
+static __attribute__((unused))
+int sys_openat(int dirfd, const char *path, int flags, mode_t mode)
+{
+	return my_syscall4(__NR_openat, dirfd, path, flags, mode);
+}
+
 static __attribute__((unused))
 int sys_pivot_root(const char *new, const char *old)
 {
@@ -1664,12 +1910,61 @@ ssize_t sys_read(int fd, void *buf, size_t count)
 	return my_syscall3(__NR_read, fd, buf, count);
 }
 
+/* Only takes offsets that fit in a long; the 64-bit offset is split over two
+ * registers on 32-bit architectures, starting on an even one on ARM and MIPS.
+ */
+static __attribute__((unused))
+ssize_t sys_readahead(int fd, off_t offset, size_t count)
+{
+#if __SIZEOF_LONG__ == 8
+	return my_syscall3(__NR_readahead, fd, offset, count);
+#elif defined(__ARM_EABI__) || defined(__mips__)
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	return my_syscall5(__NR_readahead, fd, 0, offset < 0 ? -1 : 0, offset, count);
+#else
+	return my_syscall5(__NR_readahead, fd, 0, offset, offset < 0 ? -1 : 0, count);
+#endif
+#else
+	return my_syscall4(__NR_readahead, fd, offset, offset < 0 ? -1 : 0, count);
+#endif
+}
+
+static __attribute__((unused))
+ssize_t sys_readlink(const char *path, char *buf, size_t size)
+{
+#ifdef __NR_readlinkat
+	return my_syscall4(__NR_readlinkat, AT_FDCWD, path, buf, size);
+#elif defined(__NR_readlink)
+	return my_syscall3(__NR_readlink, path, buf, size);
+#else
+#error Neither __NR_readlinkat nor __NR_readlink defined, cannot implement sys_readlink()
+#endif
+}
+
 static __attribute__((unused))
 ssize_t sys_reboot(int magic1, int magic2, int cmd, void *arg)
 {
 	return my_syscall4(__NR_reboot, magic1, magic2, cmd, arg);
 }
 
+static __attribute__((unused))
+int sys_rmdir(const char *path)
+{
+#ifdef __NR_unlinkat
+	return my_syscall3(__NR_unlinkat, AT_FDCWD, path, AT_REMOVEDIR);
+#elif defined(__NR_rmdir)
+	return my_syscall1(__NR_rmdir, path);
+#else
+#error Neither __NR_unlinkat nor __NR_rmdir defined, cannot implement sys_rmdir()
+#endif
+}
+
+static __attribute__((unused))
+int sys_rt_sigprocmask(int how, const ksigset_t *set, ksigset_t *old)
+{
+	return my_syscall4(__NR_rt_sigprocmask, how, set, old, sizeof(ksigset_t));
+}
+
 static __attribute__((unused))
 int sys_sched_yield(void)
 {
@@ -1710,12 +2005,94 @@ int sys_setpgid(pid_t pid, pid_t pgid)
 	return my_syscall2(__NR_setpgid, pid, pgid);
 }
 
+static __attribute__((unused))
+int sys_sethostname(const char *name, size_t len)
+{
+	return my_syscall2(__NR_sethostname, name, len);
+}
+
 static __attribute__((unused))
 pid_t sys_setsid(void)
 {
 	return my_syscall0(__NR_setsid);
 }
 
+static __attribute__((unused))
+int sys_signalfd4(int fd, const ksigset_t *mask, int flags)
+{
+	return my_syscall4(__NR_signalfd4, fd, mask, sizeof(ksigset_t), flags);
+}
+
+static __attribute__((unused))
+int sys_bind(int fd, const struct sockaddr_un *addr, socklen_t len)
+{
+#ifdef __NR_bind
+	return my_syscall3(__NR_bind, fd, addr, len);
+#elif defined(__NR_socketcall)
+	long args[3] = { fd, (long)addr, len };
+
+	return my_syscall2(__NR_socketcall, 2 /* SYS_BIND */, args);
+#else
+#error Neither __NR_bind nor __NR_socketcall defined, cannot implement sys_bind()
+#endif
+}
+
+static __attribute__((unused))
+int sys_connect(int fd, const struct sockaddr_un *addr, socklen_t len)
+{
+#ifdef __NR_connect
+	return my_syscall3(__NR_connect, fd, addr, len);
+#elif defined(__NR_socketcall)
+	long args[3] = { fd, (long)addr, len };
+
+	return my_syscall2(__NR_socketcall, 3 /* SYS_CONNECT */, args);
+#else
+#error Neither __NR_connect nor __NR_socketcall defined, cannot implement sys_connect()
+#endif
+}
+
+static __attribute__((unused))
+ssize_t sys_recvmsg(int fd, struct msghdr *msg, int flags)
+{
+#ifdef __NR_recvmsg
+	return my_syscall3(__NR_recvmsg, fd, msg, flags);
+#elif defined(__NR_socketcall)
+	long args[3] = { fd, (long)msg, flags };
+
+	return my_syscall2(__NR_socketcall, 17 /* SYS_RECVMSG */, args);
+#else
+#error Neither __NR_recvmsg nor __NR_socketcall defined, cannot implement sys_recvmsg()
+#endif
+}
+
+static __attribute__((unused))
+ssize_t sys_sendmsg(int fd, const struct msghdr *msg, int flags)
+{
+#ifdef __NR_sendmsg
+	return my_syscall3(__NR_sendmsg, fd, msg, flags);
+#elif defined(__NR_socketcall)
+	long args[3] = { fd, (long)msg, flags };
+
+	return my_syscall2(__NR_socketcall, 16 /* SYS_SENDMSG */, args);
+#else
+#error Neither __NR_sendmsg nor __NR_socketcall defined, cannot implement sys_sendmsg()
+#endif
+}
+
+static __attribute__((unused))
+int sys_socket(int domain, int type, int protocol)
+{
+#ifdef __NR_socket
+	return my_syscall3(__NR_socket, domain, type, protocol);
+#elif defined(__NR_socketcall)
+	long args[3] = { domain, type, protocol };
+
+	return my_syscall2(__NR_socketcall, 1 /* SYS_SOCKET */, args);
+#else
+#error Neither __NR_socket nor __NR_socketcall defined, cannot implement sys_socket()
+#endif
+}
+
 static __attribute__((unused))
 int sys_stat(const char *path, struct stat *buf)
 {
@@ -1746,6 +2123,16 @@ int sys_stat(const char *path, struct stat *buf)
 	return ret;
 }
 
+static __attribute__((unused))
+int sys_statfs(const char *path, struct statfs *buf)
+{
+#ifdef __NR_statfs
+	return my_syscall2(__NR_statfs, path, buf);
+#else
+	return -ENOSYS;
+#endif
+}
+
 
 static __attribute__((unused))
 int sys_symlink(const char *old, const char *new)
@@ -1759,6 +2146,18 @@ int sys_symlink(const char *old, const char *new)
 #endif
 }
 
+static __attribute__((unused))
+int sys_swapon(const char *path, int flags)
+{
+	return my_syscall2(__NR_swapon, path, flags);
+}
+
+static __attribute__((unused))
+void sys_sync(void)
+{
+	my_syscall0(__NR_sync);
+}
+
 static __attribute__((unused))
 mode_t sys_umask(mode_t mode)
 {
@@ -1771,6 +2170,12 @@ int sys_umount2(const char *path, int flags)
 	return my_syscall2(__NR_umount2, path, flags);
 }
 
+static __attribute__((unused))
+int sys_uname(struct utsname *buf)
+{
+	return my_syscall1(__NR_uname, buf);
+}
+
 static __attribute__((unused))
 int sys_unlink(const char *path)
 {
@@ -1801,12 +2206,31 @@ pid_t sys_wait(int *status)
 	return sys_waitpid(-1, status, 0);
 }
 
+static inline __attribute__((always_inline,unused))
+pid_t sys_vfork(void)
+{
+#ifdef __NR_clone
+	/* same as in sys_fork(), only the flags matter */
+	return my_syscall5(__NR_clone, CLONE_VM | CLONE_VFORK | SIGCHLD, 0, 0, 0, 0);
+#elif defined(__NR_vfork)
+	return my_syscall0(__NR_vfork);
+#else
+#error Neither __NR_clone nor __NR_vfork defined, cannot implement sys_vfork()
+#endif
+}
+
 static __attribute__((unused))
 ssize_t sys_write(int fd, const void *buf, size_t count)
 {
 	return my_syscall3(__NR_write, fd, buf, count);
 }
 
+static __attribute__((unused))
+ssize_t sys_writev(int fd, const struct iovec *iov, int count)
+{
+	return my_syscall3(__NR_writev, fd, iov, count);
+}
+
 
 /* Below are the libc-compatible syscalls which return x or -1 and set errno.
  * They rely on the functions above. Similarly they're marked static so that it
@@ -1879,6 +2303,18 @@ int chroot(const char *path)
 	return ret;
 }
 
+static __attribute__((unused))
+int clock_gettime(int clock, struct timespec *ts)
+{
+	int ret = sys_clock_gettime(clock, ts);
+
+	if (ret < 0) {
+		SET_ERRNO(-ret);
+		ret = -1;
+	}
+	return ret;
+}
+
 static __attribute__((unused))
 int close(int fd)
 {
@@ -1941,6 +2377,30 @@ int execve(const char *filename, char *const argv[], char *const envp[])
 	return ret;
 }
 
+static __attribute__((unused))
+int fanotify_init(unsigned int flags, unsigned int event_flags)
+{
+	int ret = sys_fanotify_init(flags, event_flags);
+
+	if (ret < 0) {
+		SET_ERRNO(-ret);
+		ret = -1;
+	}
+	return ret;
+}
+
+static __attribute__((unused))
+int fanotify_mark(int fd, unsigned int flags, uint64_t mask, int dirfd, const char *path)
+{
+	int ret = sys_fanotify_mark(fd, flags, mask, dirfd, path);
+
+	if (ret < 0) {
+		SET_ERRNO(-ret);
+		ret = -1;
+	}
+	return ret;
+}
+
 static __attribute__((unused))
 pid_t fork(void)
 {
@@ -1965,6 +2425,42 @@ int fsync(int fd)
 	return ret;
 }
 
+static __attribute__((unused))
+int fsconfig(int fd, unsigned int cmd, const char *key, const void *value, int aux)
+{
+	int ret = sys_fsconfig(fd, cmd, key, value, aux);
+
+	if (ret < 0) {
+		SET_ERRNO(-ret);
+		ret = -1;
+	}
+	return ret;
+}
+
+static __attribute__((unused))
+int fsmount(int fd, unsigned int flags, unsigned int attr_flags)
+{
+	int ret = sys_fsmount(fd, flags, attr_flags);
+
+	if (ret < 0) {
+		SET_ERRNO(-ret);
+		ret = -1;
+	}
+	return ret;
+}
+
+static __attribute__((unused))
+int fsopen(const char *fstype, unsigned int flags)
+{
+	int ret = sys_fsopen(fstype, flags);
+
+	if (ret < 0) {
+		SET_ERRNO(-ret);
+		ret = -1;
+	}
+	return ret;
+}
+
 static __attribute__((unused))
 int getdents64(int fd, struct linux_dirent64 *dirp, int count)
 {
@@ -2037,6 +2533,18 @@ int ioctl(int fd, unsigned long req, void *value)
 	return ret;
 }
 
+static __attribute__((unused))
+int kexec_file_load(int kernel_fd, int initrd_fd, unsigned long cmdline_len, const char *cmdline, unsigned long flags)
+{
+	int ret = sys_kexec_file_load(kernel_fd, initrd_fd, cmdline_len, cmdline, flags);
+
+	if (ret < 0) {
+		SET_ERRNO(-ret);
+		ret = -1;
+	}
+	return ret;
+}
+
 static __attribute__((unused))
 int kill(pid_t pid, int signal)
 {
@@ -2085,6 +2593,30 @@ int mkdir(const char *path, mode_t mode)
 	return ret;
 }
 
+static __attribute__((unused))
+int mlock(const void *addr, size_t len)
+{
+	int ret = sys_mlock(addr, len);
+
+	if (ret < 0) {
+		SET_ERRNO(-ret);
+		ret = -1;
+	}
+	return ret;
+}
+
+static __attribute__((unused))
+void *mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset)
+{
+	void *ret = sys_mmap(addr, length, prot, flags, fd, offset);
+
+	if ((unsigned long)ret >= -4095UL) {
+		SET_ERRNO(-(long)ret);
+		ret = MAP_FAILED;
+	}
+	return ret;
+}
+
 static __attribute__((unused))
 int mknod(const char *path, mode_t mode, dev_t dev)
 {
@@ -2111,6 +2643,18 @@ int mount(const char *src, const char *tgt,
 	return ret;
 }
 
+static __attribute__((unused))
+int move_mount(int from_dfd, const char *from_path, int to_dfd, const char *to_path, unsigned int flags)
+{
+	int ret = sys_move_mount(from_dfd, from_path, to_dfd, to_path, flags);
+
+	if (ret < 0) {
+		SET_ERRNO(-ret);
+		ret = -1;
+	}
+	return ret;
+}
+
 static __attribute__((unused))
 int open(const char *path, int flags, mode_t mode)
 {
@@ -2123,6 +2667,18 @@ int open(const char *path, int flags, mode_t mode)
 	return ret;
 }
 
+static __attribute__((unused))
+int openat(int dirfd, const char *path, int flags, mode_t mode)
+{
+	int ret = sys_openat(dirfd, path, flags, mode);
+
+	if (ret < 0) {
+		SET_ERRNO(-ret);
+		ret = -1;
+	}
+	return ret;
+}
+
 static __attribute__((unused))
 int pivot_root(const char *new, const char *old)
 {
@@ -2159,6 +2715,30 @@ ssize_t read(int fd, void *buf, size_t count)
 	return ret;
 }
 
+static __attribute__((unused))
+ssize_t readahead(int fd, off_t offset, size_t count)
+{
+	ssize_t ret = sys_readahead(fd, offset, count);
+
+	if (ret < 0) {
+		SET_ERRNO(-ret);
+		ret = -1;
+	}
+	return ret;
+}
+
+static __attribute__((unused))
+ssize_t readlink(const char *path, char *buf, size_t size)
+{
+	ssize_t ret = sys_readlink(path, buf, size);
+
+	if (ret < 0) {
+		SET_ERRNO(-ret);
+		ret = -1;
+	}
+	return ret;
+}
+
 static __attribute__((unused))
 int reboot(int cmd)
 {
@@ -2171,6 +2751,18 @@ int reboot(int cmd)
 	return ret;
 }
 
+static __attribute__((unused))
+int rmdir(const char *path)
+{
+	int ret = sys_rmdir(path);
+
+	if (ret < 0) {
+		SET_ERRNO(-ret);
+		ret = -1;
+	}
+	return ret;
+}
+
 static __attribute__((unused))
 void *sbrk(intptr_t inc)
 {
@@ -2184,6 +2776,18 @@ void *sbrk(intptr_t inc)
 	return (void *)-1;
 }
 
+static __attribute__((unused))
+int sigprocmask(int how, const ksigset_t *set, ksigset_t *old)
+{
+	int ret = sys_rt_sigprocmask(how, set, old);
+
+	if (ret < 0) {
+		SET_ERRNO(-ret);
+		ret = -1;
+	}
+	return ret;
+}
+
 static __attribute__((unused))
 int sched_yield(void)
 {
@@ -2220,6 +2824,18 @@ int setpgid(pid_t pid, pid_t pgid)
 	return ret;
 }
 
+static __attribute__((unused))
+int sethostname(const char *name, size_t len)
+{
+	int ret = sys_sethostname(name, len);
+
+	if (ret < 0) {
+		SET_ERRNO(-ret);
+		ret = -1;
+	}
+	return ret;
+}
+
 static __attribute__((unused))
 pid_t setsid(void)
 {
@@ -2232,6 +2848,18 @@ pid_t setsid(void)
 	return ret;
 }
 
+static __attribute__((unused))
+int signalfd(int fd, const ksigset_t *mask, int flags)
+{
+	int ret = sys_signalfd4(fd, mask, flags);
+
+	if (ret < 0) {
+		SET_ERRNO(-ret);
+		ret = -1;
+	}
+	return ret;
+}
+
 static __attribute__((unused))
 unsigned int sleep(unsigned int seconds)
 {
@@ -2243,6 +2871,66 @@ unsigned int sleep(unsigned int seconds)
 		return 0;
 }
 
+static __attribute__((unused))
+int bind(int fd, const struct sockaddr_un *addr, socklen_t len)
+{
+	int ret = sys_bind(fd, addr, len);
+
+	if (ret < 0) {
+		SET_ERRNO(-ret);
+		ret = -1;
+	}
+	return ret;
+}
+
+static __attribute__((unused))
+int connect(int fd, const struct sockaddr_un *addr, socklen_t len)
+{
+	int ret = sys_connect(fd, addr, len);
+
+	if (ret < 0) {
+		SET_ERRNO(-ret);
+		ret = -1;
+	}
+	return ret;
+}
+
+static __attribute__((unused))
+ssize_t recvmsg(int fd, struct msghdr *msg, int flags)
+{
+	ssize_t ret = sys_recvmsg(fd, msg, flags);
+
+	if (ret < 0) {
+		SET_ERRNO(-ret);
+		ret = -1;
+	}
+	return ret;
+}
+
+static __attribute__((unused))
+ssize_t sendmsg(int fd, const struct msghdr *msg, int flags)
+{
+	ssize_t ret = sys_sendmsg(fd, msg, flags);
+
+	if (ret < 0) {
+		SET_ERRNO(-ret);
+		ret = -1;
+	}
+	return ret;
+}
+
+static __attribute__((unused))
+int socket(int domain, int type, int protocol)
+{
+	int ret = sys_socket(domain, type, protocol);
+
+	if (ret < 0) {
+		SET_ERRNO(-ret);
+		ret = -1;
+	}
+	return ret;
+}
+
 static __attribute__((unused))
 int stat(const char *path, struct stat *buf)
 {
@@ -2255,6 +2943,18 @@ int stat(const char *path, struct stat *buf)
 	return ret;
 }
 
+static __attribute__((unused))
+int statfs(const char *path, struct statfs *buf)
+{
+	int ret = sys_statfs(path, buf);
+
+	if (ret < 0) {
+		SET_ERRNO(-ret);
+		ret = -1;
+	}
+	return ret;
+}
+
 static __attribute__((unused))
 int symlink(const char *old, const char *new)
 {
@@ -2267,6 +2967,24 @@ int symlink(const char *old, const char *new)
 	return ret;
 }
 
+static __attribute__((unused))
+int swapon(const char *path, int flags)
+{
+	int ret = sys_swapon(path, flags);
+
+	if (ret < 0) {
+		SET_ERRNO(-ret);
+		ret = -1;
+	}
+	return ret;
+}
+
+static __attribute__((unused))
+void sync(void)
+{
+	sys_sync();
+}
+
 static __attribute__((unused))
 int tcsetpgrp(int fd, pid_t pid)
 {
@@ -2291,6 +3009,18 @@ int umount2(const char *path, int flags)
 	return ret;
 }
 
+static __attribute__((unused))
+int uname(struct utsname *buf)
+{
+	int ret = sys_uname(buf);
+
+	if (ret < 0) {
+		SET_ERRNO(-ret);
+		ret = -1;
+	}
+	return ret;
+}
+
 static __attribute__((unused))
 int unlink(const char *path)
 {
@@ -2351,6 +3081,18 @@ ssize_t write(int fd, const void *buf, size_t count)
 	return ret;
 }
 
+static __attribute__((unused))
+ssize_t writev(int fd, const struct iovec *iov, int count)
+{
+	ssize_t ret = sys_writev(fd, iov, count);
+
+	if (ret < 0) {
+		SET_ERRNO(-ret);
+		ret = -1;
+	}
+	return ret;
+}
+
 /* some size-optimized reimplementations of a few common str* and mem*
  * functions. They're marked static, except memcpy() and raise() which are used
  * by libgcc on ARM, so they are marked weak instead in order not to cause an
@@ -2392,6 +3134,27 @@ int memcmp(const void *s1, const void *s2, size_t n)
 	return c1;
 }
 
+static __attribute__((unused))
+int strcmp(const char *s1, const char *s2)
+{
+	while (*s1 && *s1 == *s2) {
+		s1++;
+		s2++;
+	}
+	return (unsigned char)*s1 - (unsigned char)*s2;
+}
+
+static __attribute__((unused))
+int strncmp(const char *s1, const char *s2, size_t n)
+{
+	while (n && *s1 && *s1 == *s2) {
+		s1++;
+		s2++;
+		n--;
+	}
+	return n ? (unsigned char)*s1 - (unsigned char)*s2 : 0;
+}
+
 static __attribute__((unused))
 char *strcpy(char *dst, const char *src)
 {
@@ -2526,6 +3289,20 @@ void FD_SET(int fd, fd_set *set)
 	set->fd32[fd / 32] |= 1 << (fd & 31);
 }
 
+static __attribute__((unused))
+void sigemptyset(ksigset_t *set)
+{
+	memset(set, 0, sizeof(*set));
+}
+
+static __attribute__((unused))
+void sigaddset(ksigset_t *set, int signal)
+{
+	unsigned long bits = 8 * sizeof(long);
+
+	set->sig[(signal - 1) / bits] |= 1UL << ((signal - 1) % bits);
+}
+
 /* WARNING, it only deals with the 4096 first majors and 256 first minors */
 static __attribute__((unused))
 dev_t makedev(unsigned int major, unsigned int minor)